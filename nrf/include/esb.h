@@ -57,7 +57,17 @@ extern "C" {
 		.radio_irq_priority = 1,				       \
 		.event_irq_priority = 2,				       \
 		.payload_length = 32,					       \
-		.selective_auto_ack = false                                    \
+		.selective_auto_ack = false,				       \
+		.fast_ramp_up = false,					       \
+		.hw_retransmit = false,					       \
+		.timestamps = false,					       \
+		.burst_length = 0,					       \
+		.fec_group = 0,						       \
+		.rate_adaptation = false,				       \
+		.tx_power_control = false,				       \
+		.lbt_threshold = 0,					       \
+		.lbt_max_backoffs = 4,					       \
+		.lbt_backoff_us = 250					       \
 	}
 
 /** @brief Default legacy radio parameters.
@@ -78,9 +88,25 @@ extern "C" {
 		.radio_irq_priority = 1,				       \
 		.event_irq_priority = 2,				       \
 		.payload_length = 32,					       \
-		.selective_auto_ack = false                                    \
+		.selective_auto_ack = false,				       \
+		.fast_ramp_up = false,					       \
+		.hw_retransmit = false,					       \
+		.timestamps = false,					       \
+		.burst_length = 0,					       \
+		.fec_group = 0,						       \
+		.rate_adaptation = false,				       \
+		.tx_power_control = false,				       \
+		.lbt_threshold = 0,					       \
+		.lbt_max_backoffs = 4,					       \
+		.lbt_backoff_us = 250					       \
 	}
 
+/** Maximum number of frames in a burst, see esb_config.burst_length. */
+#define ESB_BURST_LENGTH_MAX 16
+
+/** Maximum number of data frames per parity frame, see esb_config.fec_group. */
+#define ESB_FEC_GROUP_MAX 14
+
 /** @brief Macro to create an initializer for a TX data packet.
  *
  *  This macro generates an initializer.
@@ -206,13 +232,62 @@ struct esb_payload {
 		       *  ack is enabled.
 		       */
 	uint8_t pid;    /**< PID assigned during communication. */
+	uint32_t timestamp; /**< Time of the address of the received packet,
+			     *  see @ref esb_get_timestamp.
+			     */
 	uint8_t data[CONFIG_ESB_MAX_PAYLOAD_LENGTH]; /**< The payload data. */
 };
 
+/** Number of buckets in the retransmit histogram of @ref esb_stats. */
+#define ESB_STATS_RETRANSMIT_BUCKETS 8
+
+/** @brief Enhanced ShockBurst link statistics of one pipe.
+ *
+ *  The counters run from @ref esb_init or the last @ref esb_reset_stats.
+ */
+struct esb_stats {
+	uint32_t tx_packets;	   /**< Packets sent successfully. */
+	uint32_t tx_failed;	   /**< Packets dropped after all retransmits. */
+	uint32_t retransmits[ESB_STATS_RETRANSMIT_BUCKETS];
+				   /**< Successful packets by number of
+				    *  retransmits, the last bucket also
+				    *  counts all higher numbers.
+				    */
+	uint32_t rx_packets;	   /**< Packets and ACK payloads received. */
+	uint32_t ack_payloads_sent; /**< ACK payloads delivered by the PRX. */
+	uint32_t crc_errors;	   /**< Packets received with a CRC error. */
+	uint32_t rx_overflows;	   /**< Packets dropped on a full RX FIFO. */
+	uint32_t rx_duplicates;	   /**< Retransmitted packets discarded. */
+	uint32_t rx_length_errors; /**< Packets dropped for their length. */
+	uint32_t fec_recovered;	   /**< Lost packets rebuilt from FEC parity. */
+	uint32_t lbt_busy;	   /**< Channel assessments that found the
+				    *  channel busy.
+				    */
+	int8_t rssi_avg;	   /**< Running average of the RSSI of the
+				    *  received packets.
+				    */
+};
+
+/** @brief Energy measured on a channel by @ref esb_scan.
+ *
+ *  The levels are RSSISAMPLE values like esb_payload.rssi, that is -dBm, so
+ *  a higher value is a quieter channel.
+ */
+struct esb_scan_result {
+	uint8_t channel;  /**< Channel number. */
+	uint8_t rssi_avg; /**< Average level of the samples. */
+	uint8_t rssi_peak; /**< Level of the strongest sample. */
+	uint16_t samples; /**< Number of samples taken. */
+};
+
 /** @brief Enhanced ShockBurst event. */
 struct esb_evt {
 	enum esb_evt_id evt_id;	/**< Enhanced ShockBurst event ID. */
 	uint32_t tx_attempts;	/**< Number of TX retransmission attempts. */
+	uint32_t tx_timestamp;	/**< Time of the address of the last TX
+				 *  attempt, see @ref esb_get_timestamp.
+				 */
+	uint32_t ack_timestamp;	/**< Time of the address of the ACK. */
 };
 
 /** @brief Event handler prototype. */
@@ -249,6 +324,92 @@ struct esb_config {
 				   *  will be acknowledged ignoring the noack
 				   *  field.
 				   */
+	bool fast_ramp_up; /**< Use the fast (~40 us) radio ramp-up instead of
+			     *  the legacy (~130 us) one. Only available on
+			     *  radios with MODECNF0. A PTX using fast ramp-up
+			     *  still works with a legacy PRX, but a PRX using
+			     *  fast ramp-up sends its ACK before a legacy PTX
+			     *  is ready to receive it.
+			     */
+	bool hw_retransmit; /**< Let PPI sequence the retransmits of a PTX
+			      *  instead of the CPU, so only a received ACK or
+			      *  the final failure raise an interrupt. Only
+			      *  used with @ref ESB_PROTOCOL_ESB_DPL on PPI
+			      *  devices and takes TIMER3 as a counter.
+			      */
+	bool timestamps; /**< Timestamp the address of every packet in
+			   *  hardware. Only available on PPI devices, takes
+			   *  TIMER1 as a free-running 1 MHz timer. The TX
+			   *  timestamp is not captured with hw_retransmit.
+			   */
+	uint8_t burst_length; /**< Burst mode, for @ref ESB_PROTOCOL_ESB_DPL.
+				*  When above 1, the PTX sends up to this
+				*  many queued packets of one pipe back to
+				*  back and the PRX acknowledges them at
+				*  once with a bitmap, so only missing ones
+				*  are sent again. Both sides must use it.
+				*  Each packet carries a 1-byte burst header,
+				*  ACK payloads are not sent and packets can
+				*  be received out of order within a burst.
+				*  A burst that runs out of retransmits
+				*  reports both events if some of its
+				*  packets were acknowledged. Only those
+				*  are removed from the TX FIFO, the
+				*  others stay at its front in order and
+				*  TX is suspended as for a failed packet
+				*  outside a burst. A packet whose ACK
+				*  was lost can then be received twice.
+				*  At most @ref ESB_BURST_LENGTH_MAX.
+				*/
+	uint8_t fec_group; /**< Forward error correction, for
+			     *  @ref ESB_PROTOCOL_ESB_DPL. When above 1, the
+			     *  PTX follows every fec_group packets of a pipe
+			     *  with a parity packet, from which the PRX
+			     *  rebuilds one lost packet of the group. Meant
+			     *  for noack streams, both sides must use it.
+			     *  Each packet carries a 1-byte FEC header and
+			     *  the parity packet a length byte, so payloads
+			     *  are limited to CONFIG_ESB_MAX_PAYLOAD_LENGTH
+			     *  - 2. Cannot be combined with burst_length.
+			     *  At most @ref ESB_FEC_GROUP_MAX. Removing
+			     *  packets from the TX buffer ends the group of
+			     *  their pipe without a parity packet.
+			     */
+	bool rate_adaptation; /**< Pick the bitrate per pipe among
+				*  @ref ESB_BITRATE_2MBPS,
+				*  @ref ESB_BITRATE_1MBPS and
+				*  @ref ESB_BITRATE_1MBPS_BLE, starting
+				*  from bitrate. A PTX steps down after
+				*  failed or retransmit-heavy packets and
+				*  back up after a run of clean ones with a
+				*  strong ACK. A PRX cycles through the
+				*  rates until it receives a packet, so its
+				*  PTX needs enough retransmits to span a
+				*  cycle: esb_init fails with -EINVAL for a
+				*  PTX whose retransmit_delay *
+				*  (retransmit_count + 1) is below the
+				*  cycle, 3 rates of 5 ms by default. The
+				*  rates are kept when esb_init is called
+				*  again with the same bitrate.
+				*/
+	bool tx_power_control; /**< Lower the TX power of a PTX per pipe
+				 *  from the RSSI of the ACKs, never above
+				 *  tx_output_power. The PRX is assumed to
+				 *  send its ACKs at tx_output_power too.
+				 *  The powers restart from tx_output_power
+				 *  only when it changes.
+				 */
+	uint8_t lbt_threshold; /**< Listen before talk. When not 0, a PTX
+				 *  samples the RSSI on the channel before
+				 *  each packet and backs off while it is
+				 *  stronger than -lbt_threshold dBm.
+				 */
+	uint8_t lbt_max_backoffs; /**< Backoffs before a packet is given up
+				    *  with @ref ESB_EVENT_TX_FAILED.
+				    */
+	uint16_t lbt_backoff_us; /**< Backoff unit. The n-th backoff waits
+				   *  a random number of units, up to 2^n.
+				   */
 };
 
 /** @brief Initialize the Enhanced ShockBurst module.
@@ -256,19 +417,35 @@ struct esb_config {
  *  @param  config	Parameters for initializing the module.
  *
  *  @return Zero on success or (negative) error code otherwise.
+ *  @retval -ENOTSUP The mode or protocol does not match a specialized build
+ *                   (ESB_PTX_ONLY, ESB_PRX_ONLY or ESB_DPL_ONLY).
  */
 int esb_init(const struct esb_config *config);
 
 /** @brief Suspend the Enhanced ShockBurst module.
  *
  *  Calling this function stops ongoing communications without changing the
- *  queues.
+ *  queues. A packet that was on air stays in the TX buffer and is sent again
+ *  by the next esb_start_tx().
  *
  * @retval 0 If successful.
  *           Otherwise, a (negative) error code is returned.
  */
 int esb_suspend(void);
 
+/** @brief Restore the radio configuration after a suspend.
+ *
+ *  Writes the configuration to the radio again, for when another protocol
+ *  used the radio in the meantime, e.g. between MPSL timeslots. Unlike
+ *  esb_init(), it keeps the queues, PIDs and statistics and does not set up
+ *  interrupts or allocate PPI channels.
+ *
+ * @retval 0 If successful.
+ * @retval -EBUSY If the module is not idle.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int esb_resume(void);
+
 /** @brief Disable the Enhanced ShockBurst module.
  *
  *  Calling this function disables the Enhanced ShockBurst module immediately.
@@ -323,12 +500,27 @@ int esb_start_tx(void);
 int esb_start_rx(void);
 
 /** @brief Stop data reception.
+ *
+ *  The radio is disabled asynchronously. The module is idle again, see
+ *  @ref esb_is_idle, once the radio interrupt has seen the radio disabled.
  *
  * @retval 0 If successful.
  *           Otherwise, a (negative) error code is returned.
  */
 int esb_stop_rx(void);
 
+/** @brief Get the worst-case execution time of the radio interrupt.
+ *
+ *  The time is measured with the DWT cycle counter since @ref esb_init.
+ *  Only available when the driver is built with ESB_ISR_PROFILING set to 1.
+ *
+ *  @param[out] cycles	Longest radio interrupt run, in CPU cycles.
+ *
+ * @retval 0 If successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int esb_get_radio_isr_wcet(uint32_t *cycles);
+
 /** @brief Flush the TX buffer.
  *
  * This function clears the TX FIFO buffer.
@@ -345,6 +537,19 @@ int esb_flush_tx(void);
  */
 int esb_pop_tx(void);
 
+/** @brief Remove the packets of one pipe from the TX buffer.
+ *
+ *  The packets of the other pipes keep their order. Only possible between
+ *  transactions, while the first packet in the TX buffer is not on air.
+ *
+ *  @param[in] pipe	Pipe.
+ *
+ * @retval 0 If successful.
+ * @retval -EBUSY If the module is not idle.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int esb_flush_tx_pipe(uint8_t pipe);
+
 /** @brief Flush the RX buffer.
  *
  * @retval 0 If successful.
@@ -441,6 +646,35 @@ int esb_set_rf_channel(uint32_t channel);
  */
 int esb_get_rf_channel(uint32_t *channel);
 
+/** @brief Measure the energy on a range of channels.
+ *
+ *  Visits the channels from first to last with the receiver on and samples
+ *  the RSSI on each, as long as the next visit fits in the time budget. A
+ *  sweep that does not fit continues in the next call with the same range,
+ *  and the samples add up over the calls until the range changes or
+ *  @ref esb_scan_reset is called. The radio and the CPU are blocked for up
+ *  to the budget, so call this when the module is idle and the time is
+ *  available, e.g. in the unused part of a timeslot. The channel setting is
+ *  not changed.
+ *
+ *  @param[in] first		First channel to scan.
+ *  @param[in] last		Last channel to scan, at most 100.
+ *  @param[in] budget_us	Time to spend.
+ *  @param[out] results		One entry per channel sampled so far, sorted
+ *				from the quietest channel to the busiest.
+ *				Until a sweep completes, only part of the
+ *				range is covered.
+ *  @param[in] count		Number of entries in results, at least
+ *				last - first + 1.
+ *
+ *  @return Number of entries in results or (negative) error code otherwise.
+ */
+int esb_scan(uint8_t first, uint8_t last, uint32_t budget_us,
+	     struct esb_scan_result *results, size_t count);
+
+/** @brief Drop the samples collected by @ref esb_scan. */
+void esb_scan_reset(void);
+
 /** @brief Set the radio output power.
  *
  *  @param[in] tx_output_power	Output power.
@@ -477,6 +711,19 @@ int esb_set_retransmit_count(uint16_t count);
  */
 int esb_set_bitrate(enum esb_bitrate bitrate);
 
+/** @brief Get the bitrate in use for a pipe.
+ *
+ *  With esb_config.rate_adaptation this is the rate chosen for the pipe,
+ *  otherwise the configured bitrate. A PRX reports the rate it listens on.
+ *
+ * @param[in] pipe	Pipe.
+ * @param[out] bitrate	Bitrate.
+ *
+ * @retval 0 If successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int esb_get_pipe_bitrate(uint8_t pipe, enum esb_bitrate *bitrate);
+
 /** @brief Reuse a packet ID for a specific pipe.
  *
  *  The ESB protocol uses a 2-bit sequence number (packet ID) to identify
@@ -522,6 +769,133 @@ int esb_get_pid(uint8_t pipe, uint8_t *pid);
  */
 int esb_set_pid(uint8_t pipe, uint8_t pid);
 
+/** @brief Get the link statistics of a pipe.
+ *
+ *  @param[in]  pipe	Pipe.
+ *  @param[out] stats	Statistics of the pipe.
+ *
+ * @retval 0 If successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int esb_get_stats(uint8_t pipe, struct esb_stats *stats);
+
+/** @brief Reset the link statistics of all pipes. */
+void esb_reset_stats(void);
+
+/** @brief Code paths measured by the ISR profiling. */
+enum esb_profile_id {
+	ESB_PROFILE_RADIO_IRQ,		   /**< Whole radio interrupt. */
+	ESB_PROFILE_DISABLED_TX_NOACK,	   /**< TX without ACK done. */
+	ESB_PROFILE_DISABLED_TX,	   /**< TX done, ACK wait started. */
+	ESB_PROFILE_DISABLED_TX_WAIT_FOR_ACK, /**< ACK received or timed out. */
+	ESB_PROFILE_DISABLED_RX,	   /**< Packet received by the PRX. */
+	ESB_PROFILE_DISABLED_RX_ACK,	   /**< ACK sent by the PRX. */
+	ESB_PROFILE_DISABLED_OTHER,	   /**< RX restart and stop. */
+	ESB_PROFILE_EVT_IRQ,		   /**< Whole event interrupt. */
+	ESB_PROFILE_EVENT_HANDLER,	   /**< Application event handler. */
+	ESB_PROFILE_COUNT
+};
+
+/** Number of buckets in the histogram of @ref esb_profile. */
+#define ESB_PROFILE_HIST_BUCKETS 16
+
+/** @brief Execution time statistics of one code path, in CPU cycles. */
+struct esb_profile {
+	uint32_t count; /**< Number of runs. */
+	uint32_t min;	/**< Shortest run. */
+	uint32_t max;	/**< Longest run. */
+	uint32_t mean;	/**< Average run. */
+	uint32_t hist[ESB_PROFILE_HIST_BUCKETS];
+			/**< Runs by log2 of their length: bucket n counts
+			 *  runs of 2^n up to 2^(n+1) - 1 cycles, the last
+			 *  bucket also counts all longer runs.
+			 */
+};
+
+/** @brief Get the execution time statistics of an ESB code path.
+ *
+ *  Only available when the driver is built with ESB_ISR_PROFILING set to 1.
+ *
+ *  @param[in]  id	Code path.
+ *  @param[out] profile	Statistics since @ref esb_init or the last
+ *			@ref esb_reset_profile.
+ *
+ * @retval 0 If successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int esb_get_profile(enum esb_profile_id id, struct esb_profile *profile);
+
+/** @brief Reset the execution time statistics of all code paths. */
+void esb_reset_profile(void);
+
+/** @brief Type of an ESB trace record. */
+enum esb_trace_type {
+	ESB_TRACE_STATE,     /**< Module started or stopped. */
+	ESB_TRACE_TX,	     /**< Packet (re)transmitted by the PTX. */
+	ESB_TRACE_TX_FAILED, /**< Packet dropped after all retransmits. */
+	ESB_TRACE_ACK_RX,    /**< ACK received by the PTX. */
+	ESB_TRACE_RX,	     /**< Packet received by the PRX. */
+	ESB_TRACE_ACK_TX,    /**< ACK sent by the PRX. */
+};
+
+/** Record flag: the packet was received with a valid CRC. */
+#define ESB_TRACE_FLAG_CRC_OK BIT(0)
+
+/** @brief Binary ESB trace record.
+ *
+ *  The layout is fixed, it is what scripts/esb_trace_pcap.py decodes.
+ */
+struct esb_trace_record {
+	uint32_t time;	 /**< k_cycle_get_32() when the record was taken. */
+	uint16_t seq;	 /**< Record number, wraps at 16 bits. */
+	uint8_t type;	 /**< Record type, see @ref esb_trace_type. */
+	uint8_t state;	 /**< Internal driver state. */
+	uint8_t pipe;	 /**< Pipe of the packet. */
+	uint8_t pid;	 /**< PID of the packet. */
+	uint8_t attempt; /**< TX attempt, starting from 1. */
+	int8_t rssi;	 /**< RSSI of a received packet. */
+	uint8_t hdr[2];	 /**< Packet header bytes in radio format. */
+	uint8_t flags;	 /**< ESB_TRACE_FLAG_* flags. */
+	uint8_t reserved;
+} __packed;
+
+/** @brief Read records from the ESB packet trace.
+ *
+ *  Only available when the driver is built with ESB_TRACE set to 1. Records
+ *  that are overwritten before they are read are counted in @p lost.
+ *
+ *  @param[out] records	Buffer for the records.
+ *  @param[in]  count	Number of records that fit in the buffer.
+ *  @param[out] lost	Number of records lost since the last read, can be
+ *			NULL.
+ *
+ *  @return Number of records read or (negative) error code otherwise.
+ */
+int esb_trace_read(struct esb_trace_record *records, size_t count,
+		   uint32_t *lost);
+
+/** @brief Drain the ESB packet trace to a SEGGER RTT up-buffer.
+ *
+ *  Only available with ESB_TRACE and CONFIG_USE_SEGGER_RTT.
+ *
+ *  @param[in] channel	RTT up-buffer index.
+ *
+ *  @return Number of records written or (negative) error code otherwise.
+ */
+int esb_trace_drain_rtt(unsigned int channel);
+
+/** @brief Get the current time of the packet timestamp timer.
+ *
+ *  The timer runs at 1 MHz while the module is initialized with
+ *  esb_config.timestamps set, and wraps at 32 bits.
+ *
+ *  @param[out] now	Current timer value in microseconds.
+ *
+ * @retval 0 If successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int esb_get_timestamp(uint32_t *now);
+
 /** @} */
 
 #ifdef __cplusplus
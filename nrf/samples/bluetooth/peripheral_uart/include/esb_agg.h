@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2021 Daniel Veilleux
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef ESB_AGG_H__
+#define ESB_AGG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <esb.h>
+
+/**
+ * Aggregation of short messages into full ESB payloads. Every message is stored as a
+ * length byte followed by the message. A payload is closed when the next message does not
+ * fit or when the timeslot ends. There is no timer, ESB_AGG_TIMEOUT_MS is only checked when
+ * a timeslot starts and on ESB TX events, so a payload opened outside a timeslot waits for
+ * the next one.
+ */
+
+/** The number of closed payloads that can wait for a timeslot. */
+#define ESB_AGG_QUEUE_LEN 8
+
+/** A payload is closed on the next ESB TX event once its first message is this old. */
+#define ESB_AGG_TIMEOUT_MS 20
+
+/** The longest message that fits in one payload. */
+#define ESB_AGG_MSG_MAX_LEN (CONFIG_ESB_MAX_PAYLOAD_LENGTH - 1)
+
+struct esb_agg_stats {
+    uint32_t messages; /**< Messages acknowledged by the peer. */
+    uint32_t payloads; /**< Payloads acknowledged by the peer. */
+};
+
+/** @brief A message was received (ESB event handler context).
+ *
+ * @note The message is passed in place from the received payload.
+ */
+typedef void (*esb_agg_rx_cb_t)(uint8_t pipe, const uint8_t *msg, uint8_t len);
+
+/** @brief Set the pipe and the callback, and drop any queued messages. */
+void esb_agg_init(uint8_t pipe, esb_agg_rx_cb_t rx_cb);
+
+/** @brief Queue a message.
+ *
+ * @retval -EMSGSIZE  len is 0 or longer than ESB_AGG_MSG_MAX_LEN
+ * @retval -ENOMEM    The queue is full
+ */
+int esb_agg_write(const uint8_t *msg, uint8_t len);
+
+/** @brief Return true if messages are waiting to be sent. */
+bool esb_agg_tx_pending(void);
+
+/** @brief ESB was initialized for a timeslot. Queues the closed payloads.
+ *
+ * @note Not for the MPSL signal handler, it reads the uptime.
+ */
+void esb_agg_start(void);
+
+/** @brief Retire acknowledged payloads and queue more. Call on ESB TX events. */
+void esb_agg_tx_update(void);
+
+/** @brief The timeslot has ended. Call after the ESB TX FIFO was flushed.
+ *
+ * @note Closes the open payload. Payloads that were not acknowledged yet are sent again in
+ *       the next timeslot.
+ */
+void esb_agg_end(void);
+
+/** @brief Pass a payload received on the aggregated pipe.
+ *
+ * @retval -EINVAL   The payload is malformed, the messages before the error were delivered
+ */
+int esb_agg_rx(const struct esb_payload *payload);
+
+/** @brief Get the message and payload counts, messages / payloads is the gain over sending
+ *         one message per payload.
+ */
+void esb_agg_get_stats(struct esb_agg_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESB_AGG_H__ */
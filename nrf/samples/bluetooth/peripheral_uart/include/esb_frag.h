@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2021 Daniel Veilleux
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef ESB_FRAG_H__
+#define ESB_FRAG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <esb.h>
+
+/**
+ * Fragmentation of messages longer than one ESB payload. Every fragment starts with a
+ * header of message ID, fragment index and fragment count. The sender keeps the message
+ * until every fragment was acknowledged, so a transfer continues in the next timeslot. The
+ * receiver reassembles fragments in any order.
+ */
+
+/** The longest message that can be sent or reassembled. */
+#define ESB_FRAG_MSG_MAX_LEN 512
+
+/** The number of messages that can be reassembled at the same time, at most one per pipe. */
+#define ESB_FRAG_RX_CONTEXTS 2
+
+/** A message is dropped when none of its fragments got through for this long. */
+#define ESB_FRAG_TIMEOUT_MS 500
+
+#define ESB_FRAG_HDR_LEN  3
+#define ESB_FRAG_DATA_LEN (CONFIG_ESB_MAX_PAYLOAD_LENGTH - ESB_FRAG_HDR_LEN)
+#define ESB_FRAG_MAX_FRAGS ((ESB_FRAG_MSG_MAX_LEN + ESB_FRAG_DATA_LEN - 1) / ESB_FRAG_DATA_LEN)
+
+/** @brief A message was reassembled (ESB event handler context).
+ *
+ * @note The message is passed in place from the reassembly buffer, which is reused as soon
+ *       as the callback returns.
+ */
+typedef void (*esb_frag_rx_cb_t)(uint8_t pipe, const uint8_t *msg, uint16_t len);
+
+/** @brief A message passed to esb_frag_send was delivered or dropped (ESB event handler context).
+ *
+ * @param[in] msg    The message buffer, which the caller owns again
+ * @param[in] result 0 if every fragment was acknowledged, -ETIMEDOUT otherwise
+ */
+typedef void (*esb_frag_tx_cb_t)(const uint8_t *msg, int result);
+
+/** @brief Set the callbacks and drop any transfer in progress. */
+void esb_frag_init(esb_frag_rx_cb_t rx_cb, esb_frag_tx_cb_t tx_cb);
+
+/** @brief Send a message on a pipe.
+ *
+ * @note The message is not copied. The buffer has to stay valid until the tx callback.
+ *       Its fragments are queued on the next ESB TX event or timeslot.
+ *
+ * @retval -EBUSY      A message is already being sent
+ * @retval -EMSGSIZE   len is 0 or longer than ESB_FRAG_MSG_MAX_LEN
+ */
+int esb_frag_send(uint8_t pipe, const uint8_t *msg, uint16_t len);
+
+/** @brief Return true if a message is waiting for fragments to be acknowledged. */
+bool esb_frag_tx_pending(void);
+
+/** @brief ESB was initialized for a timeslot. Queues the next fragments.
+ *
+ * @note Not for the MPSL signal handler, it can log and call the tx callback.
+ */
+void esb_frag_start(void);
+
+/** @brief Retire acknowledged fragments and queue more. Call on ESB TX events. */
+void esb_frag_tx_update(void);
+
+/** @brief The timeslot has ended. Call after the ESB TX FIFO was flushed.
+ *
+ * @note The fragments that were not acknowledged yet are sent again in the next timeslot.
+ */
+void esb_frag_end(void);
+
+/** @brief Pass a payload received on a fragmented pipe.
+ *
+ * @retval -EINVAL   The payload is not a valid fragment
+ * @retval -ENOMEM   No reassembly context was free
+ */
+int esb_frag_rx(const struct esb_payload *payload);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESB_FRAG_H__ */
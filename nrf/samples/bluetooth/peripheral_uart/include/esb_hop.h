@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2021 Daniel Veilleux
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef ESB_HOP_H__
+#define ESB_HOP_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+
+/**
+ * Frequency hopping per timeslot. The hop set is shuffled into a pseudo-random sequence
+ * from a seed that both peers share, and every timeslot, granted or skipped, moves one step
+ * along it. Peers that count the same timeslots stay on the same channel.
+ *
+ * The quality of every channel is tracked from the failures reported for its timeslots.
+ * Channels that go bad are taken out of the map and the sequence steps that land on them
+ * are remapped to good channels. Bad channels slowly recover and are tried again. A map
+ * change takes effect ESB_HOP_MAP_DELAY timeslots later, so it can be sent to the peer
+ * first.
+ *
+ * The peers can count different timeslots, e.g. when one of them requests timeslots on
+ * demand. The peer that decides the map, see esb_hop_set_adaptive, sends its position in the
+ * sequence every timeslot and the other one takes it over. A peer that got no position for
+ * ESB_HOP_SYNC_TIMEOUT timeslots stops hopping and listens on its channel until the sequence
+ * of the deciding peer comes by it.
+ */
+
+/** ESB channels 0 to 100, 2400 MHz to 2500 MHz. */
+#define ESB_HOP_CHANNEL_COUNT 101
+
+/** The number of 32-bit words in a channel map, bit n is channel n. */
+#define ESB_HOP_MAP_WORDS ((ESB_HOP_CHANNEL_COUNT + 31) / 32)
+
+/** Channel quality, from 0 (every attempt failed) to ESB_HOP_QUALITY_MAX. */
+#define ESB_HOP_QUALITY_MAX 255
+
+/** A channel is taken out of the map below this quality... */
+#define ESB_HOP_QUALITY_BAD 128
+
+/** ...and put back once it recovered to this quality. */
+#define ESB_HOP_QUALITY_GOOD 192
+
+/** Quality regained per timeslot by a channel out of the map. */
+#define ESB_HOP_QUALITY_RECOVERY 1
+
+/** The map is not reduced below this number of channels. */
+#define ESB_HOP_MIN_CHANNELS 8
+
+/** The number of timeslots between a map change and its use. */
+#define ESB_HOP_MAP_DELAY 16
+
+/** The number of timeslots without a sync message after which the following peer stops hopping. */
+#define ESB_HOP_SYNC_TIMEOUT 8
+
+/** The length of a sync message: the position in the sequence. */
+#define ESB_HOP_SYNC_MSG_LEN 1
+
+/** The length of a map update sent to the peer: the map bytes, then the number of timeslots
+ *  until it is used.
+ */
+#define ESB_HOP_MAP_MSG_LEN (((ESB_HOP_CHANNEL_COUNT + 7) / 8) + 1)
+
+/** @brief Build the hopping sequence and go to its start.
+ *
+ * @param[in] map    The channels to hop on
+ * @param[in] seed   The seed of the sequence, has to be the same on both peers
+ *
+ * @retval -EINVAL   The map has no channel
+ */
+int esb_hop_init(const uint32_t map[ESB_HOP_MAP_WORDS], uint32_t seed);
+
+/** @brief Return the channel of the current timeslot. */
+uint8_t esb_hop_channel(void);
+
+/** @brief Move along the sequence by a number of timeslots. */
+void esb_hop_advance(uint32_t slots);
+
+/** @brief Update the quality of a channel after a timeslot on it.
+ *
+ * @note Only the peer that decides the map, see esb_hop_set_adaptive, changes it.
+ *
+ * @param[in] channel    The channel of the timeslot
+ * @param[in] attempts   Packets sent and received, including retransmits and CRC errors
+ * @param[in] failures   Attempts that failed, i.e. retransmits, failed packets and CRC errors
+ */
+void esb_hop_report(uint8_t channel, uint32_t attempts, uint32_t failures);
+
+/** @brief Let this peer take bad channels out of the map. Off after esb_hop_init. */
+void esb_hop_set_adaptive(bool enable);
+
+/** @brief Get the map in use. */
+void esb_hop_get_map(uint32_t map[ESB_HOP_MAP_WORDS]);
+
+/** @brief Get the quality of a channel, ESB_HOP_QUALITY_MAX for a channel never used. */
+uint8_t esb_hop_get_quality(uint8_t channel);
+
+/** @brief Get the map update to send to the peer, if there is one.
+ *
+ * @param[out] msg   ESB_HOP_MAP_MSG_LEN bytes
+ *
+ * @retval true   A map change is pending, send msg until it takes effect
+ */
+bool esb_hop_map_msg(uint8_t msg[ESB_HOP_MAP_MSG_LEN]);
+
+/** @brief Apply a map update received from the peer.
+ *
+ * @retval -EINVAL   The message is malformed or the map has no channel
+ */
+int esb_hop_map_msg_rx(const uint8_t *msg, uint8_t len);
+
+/** @brief Get the sync message to send to the peer in this timeslot.
+ *
+ * @param[out] msg   ESB_HOP_SYNC_MSG_LEN bytes
+ */
+void esb_hop_sync_msg(uint8_t msg[ESB_HOP_SYNC_MSG_LEN]);
+
+/** @brief Move to the position in the sequence received from the peer.
+ *
+ * @retval -EINVAL   The message is malformed
+ */
+int esb_hop_sync_msg_rx(const uint8_t *msg, uint8_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESB_HOP_H__ */
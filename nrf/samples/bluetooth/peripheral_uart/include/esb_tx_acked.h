@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2021 Daniel Veilleux
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef ESB_TX_ACKED_H__
+#define ESB_TX_ACKED_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <esb.h>
+
+/**
+ * Counting of the acknowledged payloads of one pipe. ESB removes payloads from the TX FIFO in
+ * order and counts every acknowledged one in esb_stats.tx_packets, so the increase of that
+ * counter tells how many of the oldest payloads written on the pipe got through.
+ *
+ * @note Does not work with esb_config.burst_length, which can retire payloads out of order.
+ */
+
+struct esb_tx_acked {
+    uint8_t  pipe;
+    uint32_t base; /* esb_stats.tx_packets of the pipe when it was last counted. */
+};
+
+/** @brief Start counting on a pipe, from its current esb_stats.tx_packets. */
+void esb_tx_acked_init(struct esb_tx_acked *acked, uint8_t pipe);
+
+/** @brief Return the number of payloads acknowledged since the last call.
+ *
+ * @param[in] max   The number of payloads of the pipe in the TX FIFO
+ */
+uint32_t esb_tx_acked_get(struct esb_tx_acked *acked, uint32_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESB_TX_ACKED_H__ */
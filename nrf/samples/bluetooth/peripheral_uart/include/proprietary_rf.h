@@ -13,18 +13,44 @@ extern "C" {
 
 #include <esb.h>
 
-/* The timeslot length to request once per Connection Interval. Will not be extended. */
+/* The longest timeslot to request once per Connection Interval. Will not be extended. */
 #define TS_LEN_US 25000
 
+/** @brief Initialize ESB and the layers on top of it. Call once, before the timeslots are opened.
+ *
+ * @retval 0    Success, otherwise the error of the ESB call that failed
+ */
+int proprietary_rf_init(void);
+
+/** @brief A timeslot has started (MPSL signal handler context).
+ *
+ * @note Restores the ESB radio configuration and queues the next payload so the radio is
+ *       transmitting before the timeslot thread gets to run. Errors are reported later by
+ *       proprietary_rf_start.
+ */
+void proprietary_rf_fast_start(void);
+
 /* @brief A timeslot has started. */
 void proprietary_rf_start(void);
 
+/** @brief A timeslot is ending (MPSL signal handler context).
+ *
+ * @note Suspends ESB and flushes its TX FIFO safety_margin_us before the end of the timeslot.
+ */
+void proprietary_rf_fast_end(void);
+
 /** @brief A timeslot has ended.
  *
- * @note The timeslot will close safety_margin_us earlier than TS_LEN_US.
+ * @note Accounts for what was sent in the timeslot and moves to the next channel.
  */
 void proprietary_rf_end(void);
 
+/** @brief Return the usable timeslot length needed to send the pending payload(s).
+ *
+ * @retval 0    Nothing to send, the next timeslot can be skipped
+ */
+uint32_t proprietary_rf_demand(void);
+
 /** @brief A timeslot was blocked or cancelled.
  * 
  * @note Provided in case the network requires synchnronization, e.g. for channel hopping.
@@ -29,6 +29,12 @@ extern "C" {
  */
 #define TIMESLOT_CALLS_RADIO_IRQHANDLER 1
 
+/** The number of periodic BLE links (connections) whose anchor points can be tracked. */
+#define TIMESLOT_MAX_LINKS CONFIG_BT_MAX_CONN
+
+/** The length of the window used for timeslot_stats.min_window_airtime_us. */
+#define TS_STATS_WINDOW_MS 1000
+
 enum TIMESLOT_ERROR
 {
     /**
@@ -50,7 +56,9 @@ enum TIMESLOT_ERROR
     /** The timeslot_stop function was called twice. */
     TIMESLOT_ERROR_NO_TIMESLOT_STARTED = 89,
     /** A required pointer was not included in an argument. */
-    TIMESLOT_ERROR_INVALID_PARAM = 88
+    TIMESLOT_ERROR_INVALID_PARAM = 88,
+    /** A link ID was greater than or equal to TIMESLOT_MAX_LINKS. */
+    TIMESLOT_ERROR_INVALID_LINK = 87
 };
 
 struct timeslot_config {
@@ -64,44 +72,95 @@ struct timeslot_config {
     uint32_t timeout_us;
     /**
      * Close the timeslot this amount of time before the end to ensure that it closes cleanly.
+     * This is only the initial value if calibrate is set.
      */
     uint32_t safety_margin_us;
     /**
      * The number of skipped timeslots before an error is raised.
      */
     uint8_t skipped_tolerance;
+    /**
+     * The number of consecutive skipped timeslots that escalates the request policy by one
+     * level (shorter timeslot, then shifted request, then high priority). Zero disables it.
+     */
+    uint8_t escalation_step;
+    /**
+     * Measure the request-to-start latency and the time needed by the fast_end callback and
+     * adjust the request delay and safety margin to the smallest values that work. The
+     * safety margin is only calibrated if fast_end is set. The results are persisted if
+     * CONFIG_SETTINGS is enabled.
+     */
+    bool calibrate;
+    /**
+     * Only request a timeslot when the demand callback or timeslot_need asks for one. The
+     * length passed to timeslot_start becomes the upper limit.
+     */
+    bool on_demand;
 };
 
 #define TS_DEFAULT_CONFIG { \
     .hfclk             = MPSL_TIMESLOT_HFCLK_CFG_XTAL_GUARANTEED, \
     .timeout_us        = 2000000,                                 \
     .safety_margin_us  = 100,                                     \
-    .skipped_tolerance = 5                                        \
+    .skipped_tolerance = 5,                                       \
+    .escalation_step   = 1,                                       \
+    .calibrate         = true,                                    \
+    .on_demand         = false                                    \
 }
 
+struct timeslot_calibration {
+    /**
+     * Time between a timeslot request and the start of the timeslot.
+     */
+    uint32_t request_delay_us;
+    /**
+     * Time reserved at the end of every timeslot for the end callback.
+     */
+    uint32_t safety_margin_us;
+};
+
 struct timeslot_cb {
     /**
      * A (potentially unrecoverable) error has occurred. The err param will be set to a
      * TIMESLOT_ERROR or an error returned by an MPSL API call.
      */
     void (*error)(int err);
+    /**
+     * (Optional) Called directly from the MPSL signal handler at the beginning of every
+     * timeslot, before start. Use it to arm the radio as early as possible. This runs at the
+     * MPSL's highest interrupt priority so it must be short and must not block or log.
+     */
+    void (*fast_start)(void);
     /**
      * Called at the beginning of every timeslot.
      */
     void (*start)(void);
     /**
-     * Called TS_SAFETY_MARGIN_US before the end of every timeslot.
+     * (Optional) Called directly from the MPSL signal handler safety_margin_us before the end
+     * of every timeslot, before end. Use it to stop the radio while the timeslot is still
+     * open. The same restrictions as for fast_start apply.
+     */
+    void (*fast_end)(void);
+    /**
+     * Called at the end of every timeslot, after the timeslot was closed. The radio must not
+     * be used here unless it was left running on purpose.
      */
     void (*end)(void);
     /**
      * A timeslot has been blocked or cancelled. The count parameter is set to the number
-     * of consecutive timeslots that have been skipped.
+     * of consecutive timeslots that have been skipped. Also called for the skip that raises
+     * TIMESLOT_ERROR_REQUESTS_FAILED, before the count restarts.
      */
     void (*skipped)(uint8_t count);
     /**
      * The recurring timeslot has been stopped (the session is idle).
      */
     void (*stopped)(void);
+    /**
+     * (Optional) Polled before every request when on_demand is set. Return the usable
+     * length that is needed in the next timeslot or zero if it can be skipped.
+     */
+    uint32_t (*demand)(void);
 
 #if !TIMESLOT_USE_RADIO_IRQHANDLER
     /**
@@ -114,6 +173,34 @@ struct timeslot_cb {
 #endif
 };
 
+struct timeslot_stats {
+    /**
+     * Number of timeslots that were granted.
+     */
+    uint32_t granted;
+    /**
+     * Number of timeslots that were blocked or cancelled.
+     */
+    uint32_t skipped;
+    /**
+     * The longest run of consecutive blocked or cancelled timeslots.
+     */
+    uint8_t max_consecutive_skipped;
+    /**
+     * The current request policy level (0 is normal).
+     */
+    uint8_t policy_level;
+    /**
+     * The highest request policy level that was reached.
+     */
+    uint8_t max_policy_level;
+    /**
+     * The smallest usable timeslot time that was granted in any TS_STATS_WINDOW_MS window
+     * that contained at least one request, or UINT32_MAX if no window has completed yet.
+     */
+    uint32_t min_window_airtime_us;
+};
+
 /** @brief Open an MPSL session
  * 
  * @note Opening a session is always the first step and closing a session is not implemented
@@ -149,6 +236,59 @@ int timeslot_start(uint32_t len_us);
  */
 int timeslot_stop(void);
 
+/** @brief Add (or update) a periodic BLE link to the schedule
+ *
+ * @note Without any links every radio notification is assumed to be followed by one
+ *       Connection Event and then enough free time for the whole timeslot. With links the
+ *       timeslots are sized to fit the gap until the next predicted anchor point of any link.
+ *
+ * @param[in] id            Link ID, e.g. from bt_conn_index
+ * @param[in] interval_us   Connection Interval
+ *
+ * @retval 0                            Success
+ * @retval -TIMESLOT_ERROR_INVALID_LINK  The ID is too large
+ * @retval -TIMESLOT_ERROR_INVALID_PARAM The interval was zero
+ */
+int timeslot_link_add(uint8_t id, uint32_t interval_us);
+
+/** @brief Remove a BLE link from the schedule
+ *
+ * @param[in] id            Link ID that was passed to timeslot_link_add
+ *
+ * @retval 0                            Success
+ * @retval -TIMESLOT_ERROR_INVALID_LINK  The ID is too large
+ */
+int timeslot_link_remove(uint8_t id);
+
+/** @brief Ask for a timeslot after the next radio notification (on_demand mode)
+ *
+ * @note Can be called from any context. Calls are combined and the longest length wins.
+ *
+ * @param[in] len_us      Usable length that is needed, safety_margin_us will be added
+ *
+ * @retval 0                                   Success
+ * @retval -TIMESLOT_ERROR_NO_TIMESLOT_STARTED There is no timeslot started
+ */
+int timeslot_need(uint32_t len_us);
+
+/** @brief Get the scheduling statistics since timeslot_start
+ *
+ * @param[out] p_stats    Pointer to a timeslot_stats to fill in
+ *
+ * @retval 0                            Success
+ * @retval -TIMESLOT_ERROR_INVALID_PARAM The pointer was NULL
+ */
+int timeslot_stats_get(struct timeslot_stats *p_stats);
+
+/** @brief Get the current (possibly self-calibrated) timing values
+ *
+ * @param[out] p_cal      Pointer to a timeslot_calibration to fill in
+ *
+ * @retval 0                            Success
+ * @retval -TIMESLOT_ERROR_INVALID_PARAM The pointer was NULL
+ */
+int timeslot_calibration_get(struct timeslot_calibration *p_cal);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2021 Daniel Veilleux
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr.h>
+#include <string.h>
+
+#include <esb_agg.h>
+#include <esb_tx_acked.h>
+
+/* Payload 0 of the queue is the oldest, queue[count] the open one. */
+struct agg_queue {
+    struct esb_payload payload[ESB_AGG_QUEUE_LEN + 1];
+    uint8_t  messages[ESB_AGG_QUEUE_LEN + 1];
+    uint8_t  front;
+    uint8_t  count;   /* Closed payloads. */
+    uint8_t  written; /* Closed payloads in the ESB TX FIFO. */
+    uint32_t open_ms; /* When the first message of the open payload was written. */
+    struct esb_tx_acked tx_acked;
+};
+
+static esb_agg_rx_cb_t      rx_callback;
+static uint8_t              agg_pipe;
+static struct agg_queue     queue;
+static struct esb_agg_stats agg_stats;
+static volatile bool        active;
+
+static struct esb_payload *queue_at(uint8_t i)
+{
+    return &queue.payload[(queue.front + i) % ARRAY_SIZE(queue.payload)];
+}
+
+static uint8_t *messages_at(uint8_t i)
+{
+    return &queue.messages[(queue.front + i) % ARRAY_SIZE(queue.messages)];
+}
+
+/* Called with interrupts locked. */
+static void open_close(void)
+{
+    struct esb_payload *open = queue_at(queue.count);
+
+    if (open->length == 0 || queue.count == ESB_AGG_QUEUE_LEN) {
+        return;
+    }
+
+    queue.count++;
+    open         = queue_at(queue.count);
+    open->pipe   = agg_pipe;
+    open->noack  = false;
+    open->length = 0;
+    *messages_at(queue.count) = 0;
+}
+
+void esb_agg_init(uint8_t pipe, esb_agg_rx_cb_t rx_cb)
+{
+    unsigned int key = irq_lock();
+
+    rx_callback = rx_cb;
+    agg_pipe    = pipe;
+    memset(&queue, 0, sizeof(queue));
+    queue_at(0)->pipe = pipe;
+
+    irq_unlock(key);
+}
+
+int esb_agg_write(const uint8_t *msg, uint8_t len)
+{
+    struct esb_payload *open;
+    unsigned int key;
+
+    if (len == 0 || len > ESB_AGG_MSG_MAX_LEN) {
+        return -EMSGSIZE;
+    }
+
+    key  = irq_lock();
+    open = queue_at(queue.count);
+
+    if (open->length + 1 + len > CONFIG_ESB_MAX_PAYLOAD_LENGTH) {
+        open_close();
+        open = queue_at(queue.count);
+    }
+    if (open->length + 1 + len > CONFIG_ESB_MAX_PAYLOAD_LENGTH) {
+        irq_unlock(key);
+        return -ENOMEM;
+    }
+
+    if (open->length == 0) {
+        queue.open_ms = k_uptime_get_32();
+    }
+    open->data[open->length] = len;
+    memcpy(&open->data[open->length + 1], msg, len);
+    open->length += 1 + len;
+    (*messages_at(queue.count))++;
+
+    if (open->length == CONFIG_ESB_MAX_PAYLOAD_LENGTH) {
+        open_close();
+    }
+
+    irq_unlock(key);
+
+    return 0;
+}
+
+bool esb_agg_tx_pending(void)
+{
+    return queue.count > 0 || queue_at(0)->length > 0;
+}
+
+static void tx_retire(void)
+{
+    uint32_t sent = esb_tx_acked_get(&queue.tx_acked, queue.written);
+
+    while (sent--) {
+        agg_stats.messages += *messages_at(0);
+        agg_stats.payloads++;
+        queue.front = (queue.front + 1) % ARRAY_SIZE(queue.payload);
+        queue.count--;
+        queue.written--;
+    }
+}
+
+void esb_agg_tx_update(void)
+{
+    unsigned int key;
+
+    if (!active) {
+        return;
+    }
+
+    key = irq_lock();
+
+    tx_retire();
+
+    if (k_uptime_get_32() - queue.open_ms >= ESB_AGG_TIMEOUT_MS) {
+        open_close();
+    }
+
+    while (queue.written < queue.count) {
+        if (esb_write_payload(queue_at(queue.written))) {
+            break;
+        }
+        queue.written++;
+    }
+
+    irq_unlock(key);
+
+    /* A failed payload suspends the TX FIFO until it is restarted. */
+    if (queue.written && esb_is_idle()) {
+        (void)esb_start_tx();
+    }
+}
+
+void esb_agg_start(void)
+{
+    unsigned int key = irq_lock();
+
+    esb_tx_acked_init(&queue.tx_acked, agg_pipe);
+    active = true;
+
+    irq_unlock(key);
+
+    esb_agg_tx_update();
+}
+
+void esb_agg_end(void)
+{
+    unsigned int key;
+
+    if (!active) {
+        return;
+    }
+    active = false;
+
+    key = irq_lock();
+
+    tx_retire();
+    /* The TX FIFO was flushed, they are written again in the next timeslot. */
+    queue.written = 0;
+    open_close();
+
+    irq_unlock(key);
+}
+
+int esb_agg_rx(const struct esb_payload *payload)
+{
+    uint8_t i = 0;
+
+    while (i < payload->length) {
+        uint8_t len = payload->data[i];
+
+        if (len == 0 || i + 1 + len > payload->length) {
+            return -EINVAL;
+        }
+        if (rx_callback) {
+            rx_callback(payload->pipe, &payload->data[i + 1], len);
+        }
+        i += 1 + len;
+    }
+
+    return 0;
+}
+
+void esb_agg_get_stats(struct esb_agg_stats *stats)
+{
+    *stats = agg_stats;
+}
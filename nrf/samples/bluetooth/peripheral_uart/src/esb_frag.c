@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2021 Daniel Veilleux
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr.h>
+#include <string.h>
+
+#include <esb_frag.h>
+#include <esb_tx_acked.h>
+
+#include <logging/log.h>
+
+#define LOG_MODULE_NAME esb_frag
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#define BITMAP_WORDS ((ESB_FRAG_MAX_FRAGS + 31) / 32)
+
+struct rx_context {
+    bool     in_use;
+    uint8_t  pipe;
+    uint8_t  id;
+    uint8_t  count;
+    uint8_t  received;
+    uint16_t len;
+    uint32_t bitmap[BITMAP_WORDS];
+    uint32_t last_ms;
+    uint8_t  buf[ESB_FRAG_MSG_MAX_LEN];
+};
+
+static esb_frag_rx_cb_t rx_callback;
+static esb_frag_tx_cb_t tx_callback;
+
+static struct rx_context rx_contexts[ESB_FRAG_RX_CONTEXTS];
+/* The last reassembled message ID + 1 per pipe, to drop fragments that are sent again. */
+static uint16_t rx_done_id[CONFIG_ESB_PIPE_COUNT];
+
+static struct {
+    const uint8_t *msg;
+    uint16_t len;
+    uint8_t  pipe;
+    uint8_t  id;
+    uint8_t  count;
+    /* Fragments [0, acked) are delivered, [acked, written) are in the ESB TX FIFO. */
+    uint8_t  acked;
+    uint8_t  written;
+    struct esb_tx_acked tx_acked;
+    uint32_t last_ms;
+} tx;
+
+static volatile bool active;
+static struct esb_payload frag_payload;
+
+void esb_frag_init(esb_frag_rx_cb_t rx_cb, esb_frag_tx_cb_t tx_cb)
+{
+    rx_callback = rx_cb;
+    tx_callback = tx_cb;
+
+    memset(rx_contexts, 0, sizeof(rx_contexts));
+    memset(rx_done_id, 0, sizeof(rx_done_id));
+    tx.msg = NULL;
+}
+
+int esb_frag_send(uint8_t pipe, const uint8_t *msg, uint16_t len)
+{
+    if (tx.msg != NULL) {
+        return -EBUSY;
+    }
+    if (len == 0 || len > ESB_FRAG_MSG_MAX_LEN) {
+        return -EMSGSIZE;
+    }
+    if (pipe >= CONFIG_ESB_PIPE_COUNT) {
+        return -EINVAL;
+    }
+
+    tx.len     = len;
+    tx.pipe    = pipe;
+    tx.id++;
+    tx.count   = (len + ESB_FRAG_DATA_LEN - 1) / ESB_FRAG_DATA_LEN;
+    tx.acked   = 0;
+    tx.written = 0;
+    tx.last_ms = k_uptime_get_32();
+    esb_tx_acked_init(&tx.tx_acked, pipe);
+
+    /* Published last, the ESB event handler may run at any time. The barrier keeps the
+     * compiler from moving the stores above after it.
+     */
+    compiler_barrier();
+    tx.msg = msg;
+
+    return 0;
+}
+
+bool esb_frag_tx_pending(void)
+{
+    return tx.msg != NULL;
+}
+
+static void tx_finish(int result)
+{
+    const uint8_t *msg = tx.msg;
+
+    tx.msg = NULL;
+    if (tx_callback) {
+        tx_callback(msg, result);
+    }
+}
+
+static void tx_retire(void)
+{
+    uint32_t sent = esb_tx_acked_get(&tx.tx_acked, tx.written - tx.acked);
+
+    if (sent) {
+        tx.acked  += sent;
+        tx.last_ms = k_uptime_get_32();
+    }
+}
+
+static void tx_fill(void)
+{
+    while (tx.written < tx.count) {
+        uint16_t offset = tx.written * ESB_FRAG_DATA_LEN;
+        uint8_t  len    = MIN(tx.len - offset, ESB_FRAG_DATA_LEN);
+
+        frag_payload.pipe    = tx.pipe;
+        frag_payload.noack   = false;
+        frag_payload.length  = ESB_FRAG_HDR_LEN + len;
+        frag_payload.data[0] = tx.id;
+        frag_payload.data[1] = tx.written;
+        frag_payload.data[2] = tx.count;
+        memcpy(&frag_payload.data[ESB_FRAG_HDR_LEN], &tx.msg[offset], len);
+
+        if (esb_write_payload(&frag_payload)) {
+            break;
+        }
+        tx.written++;
+    }
+}
+
+void esb_frag_tx_update(void)
+{
+    if (!active || tx.msg == NULL) {
+        return;
+    }
+
+    tx_retire();
+
+    if (tx.acked == tx.count) {
+        tx_finish(0);
+        return;
+    }
+    if (k_uptime_get_32() - tx.last_ms > ESB_FRAG_TIMEOUT_MS) {
+        /* Keep the payloads of the other pipes. This waits for the next TX event if the
+         * first payload in the TX FIFO is on air.
+         */
+        if (esb_flush_tx_pipe(tx.pipe)) {
+            return;
+        }
+        LOG_WRN("Message %u dropped at fragment %u/%u", tx.id, tx.acked, tx.count);
+        tx_finish(-ETIMEDOUT);
+        /* Resume the payloads of the other pipes. */
+        (void)esb_start_tx();
+        return;
+    }
+
+    tx_fill();
+
+    /* A failed payload suspends the TX FIFO until it is restarted. */
+    if (esb_is_idle()) {
+        (void)esb_start_tx();
+    }
+}
+
+void esb_frag_start(void)
+{
+    /* The ESB event handler updates the transfer too once it is active. */
+    unsigned int key = irq_lock();
+
+    if (tx.msg != NULL) {
+        esb_tx_acked_init(&tx.tx_acked, tx.pipe);
+    }
+
+    active = true;
+    esb_frag_tx_update();
+
+    irq_unlock(key);
+}
+
+void esb_frag_end(void)
+{
+    if (!active) {
+        return;
+    }
+    active = false;
+
+    if (tx.msg != NULL) {
+        tx_retire();
+        /* The TX FIFO was flushed, they are written again in the next timeslot. */
+        tx.written = tx.acked;
+    }
+}
+
+static struct rx_context *rx_context_get(uint8_t pipe, uint8_t id, uint8_t count)
+{
+    struct rx_context *ctx  = NULL;
+    uint32_t           now  = k_uptime_get_32();
+
+    for (size_t i = 0; i < ARRAY_SIZE(rx_contexts); i++) {
+        struct rx_context *c = &rx_contexts[i];
+
+        if (c->in_use && now - c->last_ms > ESB_FRAG_TIMEOUT_MS) {
+            LOG_WRN("Message %u on pipe %u timed out", c->id, c->pipe);
+            c->in_use = false;
+        }
+        if (c->in_use && c->pipe == pipe) {
+            /* A new message on the pipe means the sender gave up on the previous one. */
+            if (c->id == id && c->count == count) {
+                return c;
+            }
+            ctx = c;
+            break;
+        }
+        if (!c->in_use && ctx == NULL) {
+            ctx = c;
+        }
+    }
+
+    if (ctx) {
+        ctx->in_use   = true;
+        ctx->pipe     = pipe;
+        ctx->id       = id;
+        ctx->count    = count;
+        ctx->received = 0;
+        ctx->len      = 0;
+        memset(ctx->bitmap, 0, sizeof(ctx->bitmap));
+    }
+
+    return ctx;
+}
+
+int esb_frag_rx(const struct esb_payload *payload)
+{
+    struct rx_context *ctx;
+    uint8_t id, index, count, len;
+
+    if (payload->length < ESB_FRAG_HDR_LEN + 1 || payload->pipe >= CONFIG_ESB_PIPE_COUNT) {
+        return -EINVAL;
+    }
+
+    id    = payload->data[0];
+    index = payload->data[1];
+    count = payload->data[2];
+    len   = payload->length - ESB_FRAG_HDR_LEN;
+
+    if (count == 0 || count > ESB_FRAG_MAX_FRAGS || index >= count ||
+        (index < count - 1 && len != ESB_FRAG_DATA_LEN) ||
+        (uint32_t)index * ESB_FRAG_DATA_LEN + len > ESB_FRAG_MSG_MAX_LEN) {
+        return -EINVAL;
+    }
+
+    if (rx_done_id[payload->pipe] == id + 1) {
+        return 0;
+    }
+
+    ctx = rx_context_get(payload->pipe, id, count);
+    if (!ctx) {
+        return -ENOMEM;
+    }
+
+    ctx->last_ms = k_uptime_get_32();
+
+    if (ctx->bitmap[index / 32] & BIT(index % 32)) {
+        return 0;
+    }
+
+    ctx->bitmap[index / 32] |= BIT(index % 32);
+    ctx->received++;
+    memcpy(&ctx->buf[index * ESB_FRAG_DATA_LEN], &payload->data[ESB_FRAG_HDR_LEN], len);
+    if (index == count - 1) {
+        ctx->len = index * ESB_FRAG_DATA_LEN + len;
+    }
+
+    if (ctx->received == ctx->count) {
+        rx_done_id[ctx->pipe] = ctx->id + 1;
+        if (rx_callback) {
+            rx_callback(ctx->pipe, ctx->buf, ctx->len);
+        }
+        ctx->in_use = false;
+    }
+
+    return 0;
+}
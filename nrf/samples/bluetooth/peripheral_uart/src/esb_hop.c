@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2021 Daniel Veilleux
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr.h>
+#include <string.h>
+
+#include <esb_hop.h>
+
+#define MAP_BYTES (ESB_HOP_MAP_MSG_LEN - 1)
+
+static uint8_t  sequence[ESB_HOP_CHANNEL_COUNT];
+static uint8_t  sequence_len;
+static uint32_t slot;
+
+/* The channels in use, the sequence steps that land outside of them are remapped here. */
+static uint32_t map[ESB_HOP_MAP_WORDS];
+static uint8_t  used[ESB_HOP_CHANNEL_COUNT];
+static uint8_t  used_len;
+
+static uint8_t  quality[ESB_HOP_CHANNEL_COUNT];
+static bool     adaptive;
+
+/* A map change waiting for its timeslot. */
+static uint32_t pending_map[ESB_HOP_MAP_WORDS];
+static uint8_t  pending_slots;
+static bool     pending;
+
+/* Timeslots since the last sync message, on the peer that follows. */
+static uint32_t unsynced;
+
+/* xorshift32, the same on every peer for the same seed. */
+static uint32_t prng_next(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+static bool map_has(const uint32_t *m, uint8_t ch)
+{
+    return (m[ch / 32] & BIT(ch % 32)) != 0;
+}
+
+static uint8_t map_apply(const uint32_t *m)
+{
+    uint8_t len = 0;
+
+    for (uint8_t ch = 0; ch < ESB_HOP_CHANNEL_COUNT; ch++) {
+        if (map_has(m, ch)) {
+            used[len++] = ch;
+        }
+    }
+    if (len) {
+        memcpy(map, m, sizeof(map));
+        used_len = len;
+    }
+
+    return len;
+}
+
+int esb_hop_init(const uint32_t hop_map[ESB_HOP_MAP_WORDS], uint32_t seed)
+{
+    uint32_t state = seed ? seed : 1;
+    uint8_t  len;
+
+    len = map_apply(hop_map);
+    if (len == 0) {
+        return -EINVAL;
+    }
+    memcpy(sequence, used, len);
+
+    /* Fisher-Yates shuffle. */
+    for (uint8_t i = len - 1; i > 0; i--) {
+        uint8_t j   = prng_next(&state) % (i + 1);
+        uint8_t tmp = sequence[i];
+
+        sequence[i] = sequence[j];
+        sequence[j] = tmp;
+    }
+
+    sequence_len = len;
+    slot         = 0;
+    adaptive     = false;
+    pending      = false;
+    unsynced     = 0;
+    memset(quality, ESB_HOP_QUALITY_MAX, sizeof(quality));
+
+    return 0;
+}
+
+uint8_t esb_hop_channel(void)
+{
+    uint8_t ch = sequence[slot];
+
+    if (!map_has(map, ch)) {
+        ch = used[slot % used_len];
+    }
+
+    return ch;
+}
+
+void esb_hop_advance(uint32_t slots)
+{
+    if (sequence_len == 0) {
+        return;
+    }
+
+    /* Out of step, wait on this channel until the sequence of the peer comes by. */
+    if (!adaptive) {
+        unsynced = MIN(unsynced + slots, ESB_HOP_SYNC_TIMEOUT);
+    }
+    if (adaptive || unsynced < ESB_HOP_SYNC_TIMEOUT) {
+        slot = (slot + slots) % sequence_len;
+    }
+
+    if (pending) {
+        if (pending_slots > slots) {
+            pending_slots -= slots;
+        } else {
+            pending = false;
+            (void)map_apply(pending_map);
+        }
+    }
+}
+
+static void map_update(void)
+{
+    uint32_t next[ESB_HOP_MAP_WORDS];
+    uint8_t  count = 0;
+
+    memcpy(next, pending ? pending_map : map, sizeof(next));
+
+    for (uint8_t i = 0; i < sequence_len; i++) {
+        uint8_t ch = sequence[i];
+
+        if (map_has(next, ch) && quality[ch] < ESB_HOP_QUALITY_BAD) {
+            next[ch / 32] &= ~BIT(ch % 32);
+        } else if (!map_has(next, ch) && quality[ch] >= ESB_HOP_QUALITY_GOOD) {
+            next[ch / 32] |= BIT(ch % 32);
+        }
+    }
+
+    for (uint8_t i = 0; i < sequence_len; i++) {
+        count += map_has(next, sequence[i]);
+    }
+    if (count < ESB_HOP_MIN_CHANNELS ||
+        memcmp(next, pending ? pending_map : map, sizeof(next)) == 0) {
+        return;
+    }
+
+    memcpy(pending_map, next, sizeof(pending_map));
+    pending_slots = ESB_HOP_MAP_DELAY;
+    pending       = true;
+}
+
+void esb_hop_report(uint8_t channel, uint32_t attempts, uint32_t failures)
+{
+    if (channel >= ESB_HOP_CHANNEL_COUNT) {
+        return;
+    }
+
+    if (attempts) {
+        uint32_t sample = ESB_HOP_QUALITY_MAX * (attempts - MIN(failures, attempts)) / attempts;
+
+        /* Exponential moving average, 1/8 of the new sample. */
+        quality[channel] = (quality[channel] * 7 + sample) / 8;
+    }
+
+    /* Channels out of the map get no samples, let them recover to be tried again. */
+    for (uint8_t i = 0; i < sequence_len; i++) {
+        uint8_t ch = sequence[i];
+
+        if (!map_has(map, ch)) {
+            quality[ch] = MIN(quality[ch] + ESB_HOP_QUALITY_RECOVERY, ESB_HOP_QUALITY_MAX);
+        }
+    }
+
+    if (adaptive) {
+        map_update();
+    }
+}
+
+void esb_hop_set_adaptive(bool enable)
+{
+    adaptive = enable;
+}
+
+void esb_hop_get_map(uint32_t out[ESB_HOP_MAP_WORDS])
+{
+    memcpy(out, map, sizeof(map));
+}
+
+uint8_t esb_hop_get_quality(uint8_t channel)
+{
+    return channel < ESB_HOP_CHANNEL_COUNT ? quality[channel] : 0;
+}
+
+bool esb_hop_map_msg(uint8_t msg[ESB_HOP_MAP_MSG_LEN])
+{
+    if (!pending) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < MAP_BYTES; i++) {
+        msg[i] = pending_map[i / 4] >> (8 * (i % 4));
+    }
+    msg[MAP_BYTES] = pending_slots;
+
+    return true;
+}
+
+int esb_hop_map_msg_rx(const uint8_t *msg, uint8_t len)
+{
+    uint32_t next[ESB_HOP_MAP_WORDS] = {0};
+    uint8_t  count = 0;
+
+    if (len != ESB_HOP_MAP_MSG_LEN || msg[MAP_BYTES] == 0) {
+        return -EINVAL;
+    }
+
+    for (uint8_t i = 0; i < MAP_BYTES; i++) {
+        next[i / 4] |= (uint32_t)msg[i] << (8 * (i % 4));
+    }
+    for (uint8_t ch = 0; ch < ESB_HOP_CHANNEL_COUNT; ch++) {
+        count += map_has(next, ch);
+    }
+    if (count == 0) {
+        return -EINVAL;
+    }
+
+    memcpy(pending_map, next, sizeof(pending_map));
+    pending_slots = msg[MAP_BYTES];
+    pending       = true;
+
+    return 0;
+}
+
+void esb_hop_sync_msg(uint8_t msg[ESB_HOP_SYNC_MSG_LEN])
+{
+    msg[0] = slot;
+}
+
+int esb_hop_sync_msg_rx(const uint8_t *msg, uint8_t len)
+{
+    if (len != ESB_HOP_SYNC_MSG_LEN || msg[0] >= sequence_len) {
+        return -EINVAL;
+    }
+
+    slot     = msg[0];
+    unsynced = 0;
+
+    return 0;
+}
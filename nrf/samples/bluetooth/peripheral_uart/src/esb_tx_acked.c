@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2021 Daniel Veilleux
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr.h>
+
+#include <esb_tx_acked.h>
+
+void esb_tx_acked_init(struct esb_tx_acked *acked, uint8_t pipe)
+{
+    struct esb_stats stats;
+
+    acked->pipe = pipe;
+    acked->base = (esb_get_stats(pipe, &stats) == 0) ? stats.tx_packets : 0;
+}
+
+uint32_t esb_tx_acked_get(struct esb_tx_acked *acked, uint32_t max)
+{
+    struct esb_stats stats;
+    uint32_t sent;
+
+    if (esb_get_stats(acked->pipe, &stats)) {
+        return 0;
+    }
+
+    sent = MIN(stats.tx_packets - acked->base, max);
+    acked->base += sent;
+
+    return sent;
+}
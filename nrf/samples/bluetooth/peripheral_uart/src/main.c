@@ -33,6 +33,7 @@
 LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
 #define DESIRED_CONN_INTERVAL 28
+#define CONN_INTERVAL_UNIT_US 1250
 
 #define DEVICE_NAME CONFIG_BT_DEVICE_NAME
 #define DEVICE_NAME_LEN (sizeof(DEVICE_NAME) - 1)
@@ -41,6 +42,7 @@ static struct bt_conn *current_conn;
 static struct bt_conn *auth_conn;
 
 static bool timeslot_running;
+static uint8_t conn_count;
 
 static struct timeslot_config timeslot_config = TS_DEFAULT_CONFIG;
 
@@ -74,7 +76,10 @@ static void connected(struct bt_conn *conn, uint8_t err)
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
     LOG_INF("Connected %s", log_strdup(addr));
 
-    current_conn = bt_conn_ref(conn);
+    if (!current_conn) {
+        current_conn = bt_conn_ref(conn);
+    }
+    conn_count++;
 }
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
@@ -90,12 +95,22 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
         auth_conn = NULL;
     }
 
-    if (current_conn) {
+    if (current_conn == conn) {
         bt_conn_unref(current_conn);
         current_conn = NULL;
     }
 
-    int err = timeslot_stop();
+    int err = timeslot_link_remove(bt_conn_index(conn));
+    if (err) {
+        LOG_ERR("timeslot_link_remove failed (err=%d)", err);
+    }
+
+    if (--conn_count > 0) {
+        /* Keep using the gaps between the remaining links' Connection Events. */
+        return;
+    }
+
+    err = timeslot_stop();
     if (err) {
         LOG_ERR("timeslot_stop failed (err=%d)", err);
         error();
@@ -128,6 +143,11 @@ static void conn_param_updated(struct bt_conn *conn, uint16_t interval,
             LOG_ERR("bt_conn_le_param_update failed (err=%d)", err);
         }
     } else {
+        err = timeslot_link_add(bt_conn_index(conn), interval * CONN_INTERVAL_UNIT_US);
+        if (err) {
+            LOG_ERR("timeslot_link_add failed (err=%d)", err);
+        }
+
         if (!timeslot_running) {
             err = timeslot_start(TS_LEN_US);
             if (err) {
@@ -181,7 +201,20 @@ static void timeslot_err_cb(int err)
 
 static void timeslot_stopped_cb(void)
 {
-    LOG_INF("Timeslot stopped");
+    struct timeslot_calibration cal;
+    struct timeslot_stats       stats;
+
+    if (!timeslot_calibration_get(&cal)) {
+        LOG_INF("Timeslot stopped (request_delay_us=%d, safety_margin_us=%d)",
+                    cal.request_delay_us, cal.safety_margin_us);
+    }
+    if (!timeslot_stats_get(&stats)) {
+        LOG_INF("Timeslots granted=%d, skipped=%d (max consecutive=%d, max level=%d)",
+                    stats.granted, stats.skipped, stats.max_consecutive_skipped,
+                    stats.max_policy_level);
+        LOG_INF("Minimum airtime per %d ms: %u us", TS_STATS_WINDOW_MS,
+                    stats.min_window_airtime_us);
+    }
     timeslot_running  = false;
 }
 
@@ -193,13 +226,16 @@ static void radio_irq_cb(void)
 #endif
 
 static struct timeslot_cb timeslot_callbacks = {
-    .error     = timeslot_err_cb,
-    .start     = proprietary_rf_start,
-    .end       = proprietary_rf_end,
-    .skipped   = proprietary_rf_skipped,
-    .stopped   = timeslot_stopped_cb,
+    .error      = timeslot_err_cb,
+    .fast_start = proprietary_rf_fast_start,
+    .fast_end   = proprietary_rf_fast_end,
+    .start      = proprietary_rf_start,
+    .end        = proprietary_rf_end,
+    .skipped    = proprietary_rf_skipped,
+    .stopped    = timeslot_stopped_cb,
+    .demand     = proprietary_rf_demand,
 #if !TIMESLOT_CALLS_RADIO_IRQHANDLER
-    .radio_irq = radio_irq_cb
+    .radio_irq  = radio_irq_cb
 #endif
 };
 
@@ -209,6 +245,15 @@ void main(void)
 
     bt_conn_cb_register(&conn_callbacks);
 
+    err = proprietary_rf_init();
+    if (err) {
+        LOG_ERR("proprietary_rf_init failed (err: %d)", err);
+        error();
+    }
+
+    /* Only use radio time when proprietary_rf has something to send. */
+    timeslot_config.on_demand = true;
+
     err = timeslot_open(&timeslot_config, &timeslot_callbacks);
     if (err) {
         LOG_ERR("timeslot_open failed (err: %d)", err);
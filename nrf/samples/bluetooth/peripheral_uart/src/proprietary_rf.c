@@ -2,6 +2,9 @@
 #include <drivers/gpio.h>
 
 #include <proprietary_rf.h>
+#include <esb_frag.h>
+#include <esb_agg.h>
+#include <esb_hop.h>
 
 #include <logging/log.h>
 
@@ -9,13 +12,49 @@
 LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
 #define TX_PIPE 0
+/* Messages longer than one payload, see esb_frag.h. */
+#define FRAG_PIPE 1
+/* Short messages packed into full payloads, see esb_agg.h. */
+#define AGG_PIPE  2
+
+/* Hop over 2402-2480 MHz, seeded from base address 0 so the PRX follows the same sequence. */
+#define HOP_CHANNEL_FIRST 2
+#define HOP_CHANNEL_LAST  80
+#define HOP_SEED          0xE7E7E7E7
+/* Channel map updates to the PRX, see esb_hop.h. */
+#define HOP_PIPE          3
+
+#define TX_RETRANSMIT_DELAY_US 600
+#define TX_RETRANSMIT_COUNT    3
+
+/* Restoring ESB plus the worst case airtime of one payload, including retransmits. */
+#define TX_PAYLOAD_LEN_US      (1000 + ((TX_RETRANSMIT_COUNT + 1) * TX_RETRANSMIT_DELAY_US))
 
 static const struct device *led_port;
 static struct esb_payload   rx_payload;
+static struct esb_payload   hop_payload;
 static bool                 ready      = true;
 static struct esb_payload   tx_payload = ESB_CREATE_PAYLOAD(TX_PIPE, 0x01, 0x00, 0x03, 0x04,
                                                                      0x05, 0x06, 0x07, 0x08);
-static uint8_t tx_pipe_pid;
+static uint8_t led_value;
+static int     fast_start_err;
+static int     fast_end_err;
+static uint8_t hop_skipped;
+
+static void frag_rx_cb(uint8_t pipe, const uint8_t *msg, uint16_t len)
+{
+    LOG_INF("Message received on pipe %d, len %d", pipe, len);
+}
+
+static void frag_tx_cb(const uint8_t *msg, int result)
+{
+    LOG_INF("Message sent, result %d", result);
+}
+
+static void agg_rx_cb(uint8_t pipe, const uint8_t *msg, uint8_t len)
+{
+    LOG_INF("Short message received on pipe %d, len %d", pipe, len);
+}
 
 static void esb_cb(struct esb_evt const *event)
 {
@@ -24,12 +63,32 @@ static void esb_cb(struct esb_evt const *event)
     switch (event->evt_id) {
     case ESB_EVENT_TX_SUCCESS:
         LOG_INF("ESB TX SUCCESS EVENT");
+        esb_frag_tx_update();
+        esb_agg_tx_update();
         break;
     case ESB_EVENT_TX_FAILED:
         LOG_INF("ESB TX FAILED EVENT");
+        esb_frag_tx_update();
+        esb_agg_tx_update();
         break;
     case ESB_EVENT_RX_RECEIVED:
         while (esb_read_rx_payload(&rx_payload) == 0) {
+            if (rx_payload.pipe == FRAG_PIPE) {
+                (void)esb_frag_rx(&rx_payload);
+                continue;
+            }
+            if (rx_payload.pipe == AGG_PIPE) {
+                (void)esb_agg_rx(&rx_payload);
+                continue;
+            }
+            if (rx_payload.pipe == HOP_PIPE) {
+                if (rx_payload.length == ESB_HOP_SYNC_MSG_LEN) {
+                    (void)esb_hop_sync_msg_rx(rx_payload.data, rx_payload.length);
+                } else {
+                    (void)esb_hop_map_msg_rx(rx_payload.data, rx_payload.length);
+                }
+                continue;
+            }
             LOG_INF("Packet received, len %d : "
                 "0x%02x, 0x%02x, 0x%02x, 0x%02x, "
                 "0x%02x, 0x%02x, 0x%02x, 0x%02x",
@@ -56,11 +115,16 @@ static int esb_initialize(void)
     struct esb_config config = ESB_DEFAULT_CONFIG;
 
     config.protocol           = ESB_PROTOCOL_ESB_DPL;
-    config.retransmit_delay   = 600;
+    config.retransmit_delay   = TX_RETRANSMIT_DELAY_US;
+    config.retransmit_count   = TX_RETRANSMIT_COUNT;
     config.bitrate            = ESB_BITRATE_2MBPS;
     config.event_handler      = esb_cb;
     config.mode               = ESB_MODE_PTX;
     config.selective_auto_ack = true;
+#if defined(RADIO_MODECNF0_RU_Msk)
+    /* Shortens every transaction and still works with a legacy PRX. */
+    config.fast_ramp_up       = true;
+#endif
 
     err = esb_init(&config);
 
@@ -137,47 +201,162 @@ static void leds_update(uint8_t value)
     }
 }
 
+/* Rate the channel of the timeslot from the attempts it took to send the payloads. */
+static void hop_report(void)
+{
+    uint32_t attempts = 0;
+    uint32_t packets  = 0;
+
+    for (uint8_t pipe = 0; pipe < CONFIG_ESB_PIPE_COUNT; pipe++) {
+        struct esb_stats stats;
+
+        if (esb_get_stats(pipe, &stats)) {
+            continue;
+        }
+        for (uint8_t i = 0; i < ESB_STATS_RETRANSMIT_BUCKETS; i++) {
+            attempts += (i + 1) * stats.retransmits[i];
+        }
+        attempts += stats.tx_failed * (TX_RETRANSMIT_COUNT + 1);
+        packets  += stats.tx_packets;
+    }
+
+    esb_hop_report(esb_hop_channel(), attempts, attempts - MIN(packets, attempts));
+}
+
+void proprietary_rf_fast_end(void)
+{
+    fast_end_err = esb_suspend();
+    (void)esb_flush_tx();
+}
+
 void proprietary_rf_end(void)
 {
-    int err = esb_get_pid(TX_PIPE, &tx_pipe_pid);
-    if (err) {
-        LOG_ERR("esb_get_pid failed (err=%d)", err);
-    }    
-    esb_disable();
+    if (fast_end_err) {
+        LOG_ERR("esb_suspend failed (err=%d)", fast_end_err);
+        fast_end_err = 0;
+    }
+
+    esb_frag_end();
+    esb_agg_end();
+    hop_report();
+    /* Count the next timeslot on its own. */
+    esb_reset_stats();
+
+    esb_hop_advance(1);
+    hop_skipped = 0;
+
+    /* Anything that was still in flight was flushed by proprietary_rf_fast_end. */
+    ready = true;
+}
+
+uint32_t proprietary_rf_demand(void)
+{
+    if (esb_frag_tx_pending() || esb_agg_tx_pending()) {
+        return TS_LEN_US;
+    }
+    if (!ready) {
+        return 0;
+    }
+    return MIN(TX_PAYLOAD_LEN_US, TS_LEN_US);
 }
 
 void proprietary_rf_skipped(uint8_t count)
 {
     LOG_INF("proprietary_rf_skipped(count=%d)", count);
+
+    /* count is the number of consecutive skipped timeslots so far, it restarts after an error. */
+    esb_hop_advance(count > hop_skipped ? count - hop_skipped : count);
+    hop_skipped = count;
 }
 
-void proprietary_rf_start(void)
+static void hop_init(void)
 {
-    int err;
+    uint32_t map[ESB_HOP_MAP_WORDS] = {0};
 
-    leds_init();
+    for (uint8_t ch = HOP_CHANNEL_FIRST; ch <= HOP_CHANNEL_LAST; ch++) {
+        map[ch / 32] |= BIT(ch % 32);
+    }
+    (void)esb_hop_init(map, HOP_SEED);
+    /* The PTX decides the map and sends it to the PRX. */
+    esb_hop_set_adaptive(true);
+}
+
+int proprietary_rf_init(void)
+{
+    int err;
 
     err = esb_initialize();
     if (err) {
-        LOG_ERR("ESB initialization failed, err %d", err);
+        return err;
+    }
+
+    hop_init();
+    esb_frag_init(frag_rx_cb, frag_tx_cb);
+    esb_agg_init(AGG_PIPE, agg_rx_cb);
+
+    return 0;
+}
+
+void proprietary_rf_fast_start(void)
+{
+    int err;
+
+    /* BLE reconfigured the radio since the last timeslot. */
+    fast_start_err = esb_resume();
+    if (fast_start_err) {
         return;
     }
 
-    err = esb_set_pid(TX_PIPE, tx_pipe_pid);
+    err = esb_set_rf_channel(esb_hop_channel());
     if (err) {
-        LOG_ERR("esb_set_pid failed (err=%d)", err);
+        fast_start_err = err;
+        return;
     }
 
     tx_payload.noack = false;
     if (ready) {
         ready = false;
         esb_flush_tx();
-        leds_update(tx_payload.data[1]);
+        led_value = tx_payload.data[1];
 
         err = esb_write_payload(&tx_payload);
         if (err) {
-            LOG_ERR("Payload write failed, err %d", err);
+            fast_start_err = err;
         }
         tx_payload.data[1]++;
     }
+
+    /* Queued after the flush above, which would drop them even while they are on air. */
+    esb_hop_sync_msg(hop_payload.data);
+    hop_payload.pipe   = HOP_PIPE;
+    hop_payload.length = ESB_HOP_SYNC_MSG_LEN;
+    hop_payload.noack  = false;
+    err = esb_write_payload(&hop_payload);
+    if (err) {
+        fast_start_err = err;
+    }
+
+    if (esb_hop_map_msg(hop_payload.data)) {
+        hop_payload.length = ESB_HOP_MAP_MSG_LEN;
+        err = esb_write_payload(&hop_payload);
+        if (err) {
+            fast_start_err = err;
+        }
+    }
+}
+
+void proprietary_rf_start(void)
+{
+    leds_init();
+
+    if (fast_start_err) {
+        LOG_ERR("ESB fast start failed, err %d", fast_start_err);
+        fast_start_err = 0;
+        return;
+    }
+
+    esb_frag_start();
+    esb_agg_start();
+
+    leds_update(led_value);
 }
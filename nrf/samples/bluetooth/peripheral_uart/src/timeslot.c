@@ -6,6 +6,7 @@
 
 #include <zephyr.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <logging/log.h>
 
@@ -27,6 +28,10 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #define REQUEST_PIN                31
 #endif
 
+#if defined(CONFIG_SETTINGS)
+#include <settings/settings.h>
+#endif
+
 #include <timeslot.h>
 
 /* The radio notification distance in microseconds */
@@ -35,11 +40,55 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 /* The (empirical) distance between a request and the resulting timeslot start */
 #define TS_REQUEST_DELAY_US        2600
 
+/*
+ * Self-calibration limits. The request delay is increased by the full amount whenever a
+ * timeslot starts late and otherwise decreased by TS_CAL_STEP_US per timeslot. The safety
+ * margin follows the time taken by the fast_end callback, measured with TIMER0, plus
+ * TS_CAL_GUARD_US for returning the end action to the MPSL.
+ */
+#define TS_CAL_REQUEST_DELAY_MIN_US  500
+#define TS_CAL_REQUEST_DELAY_MAX_US  (CONFIG_SDC_MAX_CONN_EVENT_LEN_DEFAULT + TS_RNH_DISTANCE_US)
+#define TS_CAL_TOLERANCE_US          31
+#define TS_CAL_STEP_US               10
+#define TS_CAL_GUARD_US              31
+#define TS_CAL_SAFETY_MARGIN_MIN_US  50
+#define TS_CAL_DECAY_SHIFT           4
+
+/*
+ * Link tracking. A radio notification is matched to a link if it is within
+ * TS_LINK_TOLERANCE_US of that link's predicted anchor point. A link that hasn't matched
+ * for TS_LINK_RESYNC_EVENTS intervals is synchronized again with the next unmatched event.
+ * Timeslots end TS_LINK_GUARD_US before the next predicted anchor point.
+ */
+#define TS_LINK_TOLERANCE_US         500
+#define TS_LINK_RESYNC_EVENTS        32
+#define TS_LINK_GUARD_US             500
+
+/*
+ * Starvation avoidance. Each level includes the measures of the levels below it and one
+ * level is relaxed again after TS_POLICY_RELAX_COUNT consecutive granted timeslots.
+ */
+#define TS_POLICY_SHIFT_US           1000
+#define TS_POLICY_MIN_LEN_US         1000
+#define TS_POLICY_RELAX_COUNT        8
+
+#if defined(CONFIG_SETTINGS)
+#define TIMESLOT_THREAD_STACK_SIZE 1536
+#else
 #define TIMESLOT_THREAD_STACK_SIZE 768
+#endif
 #define TIMESLOT_THREAD_PRIORITY   5
 
 #define INVALID_MPSL_SIGNAL        11
 
+enum POLICY_LEVEL
+{
+    POLICY_LEVEL_NORMAL  = 0x00,
+    POLICY_LEVEL_SHORTEN = 0x01, /* Request half the length (at least TS_POLICY_MIN_LEN_US). */
+    POLICY_LEVEL_SHIFT   = 0x02, /* Request TS_POLICY_SHIFT_US later after the notification. */
+    POLICY_LEVEL_HIGH    = 0x03  /* Request with MPSL_TIMESLOT_PRIORITY_HIGH. */
+};
+
 enum SIGNAL_CODE
 {
     SIGNAL_CODE_START             = 0x00,
@@ -54,12 +103,29 @@ enum SIGNAL_CODE
 };
 
 static uint32_t                ts_len_us;
+static uint32_t                ts_max_len_us;
+static uint32_t                needed_len_us;
 static uint8_t                 blocked_cancelled_count;
 static bool                    session_open;
 static bool                    timeslot_started;
 static bool                    timeslot_stopping;
 static bool                    timeslot_requested;
 static uint32_t                mpsl_callback_signal=INVALID_MPSL_SIGNAL;
+static uint32_t                request_delay_us = TS_REQUEST_DELAY_US;
+static uint32_t                safety_margin_us;
+static uint32_t                end_max_us;
+static bool                    calibration_dirty;
+static uint32_t                rnh_cyc;
+static uint32_t                request_rnh_cyc;
+static uint32_t                request_shift_us;
+static uint8_t                 policy_level;
+static uint8_t                 granted_streak;
+static uint32_t                window_start_ms;
+static uint32_t                window_airtime_us;
+static uint32_t                window_requests;
+static struct timeslot_stats   stats;
+static uint32_t                start_cyc;
+static uint32_t                fast_end_us;
 static struct timeslot_config *p_timeslot_config;
 static struct timeslot_cb     *p_timeslot_callbacks;
 
@@ -70,6 +136,14 @@ static struct k_poll_event events[1]     = {
                                     &timeslot_sig, 0),
 };
 
+struct link {
+    uint32_t interval_cyc; /* Zero if the entry is not used. */
+    uint32_t anchor_cyc;   /* The last matched anchor point. */
+    bool     synced;
+};
+
+static struct link links[TIMESLOT_MAX_LINKS];
+
 static mpsl_timeslot_session_id_t mpsl_session_id;
 
 /* NOTE: MPSL return params must be in static scope. */
@@ -114,10 +188,15 @@ mpsl_cb(mpsl_timeslot_session_id_t session_id, uint32_t signal)
         }
 
         /* TIMER0 is pre-configured for 1MHz mode by the MPSL. */
-        NRF_TIMER0->CC[0]    = (ts_len_us - p_timeslot_config->safety_margin_us);
+        NRF_TIMER0->CC[0]    = (ts_len_us - safety_margin_us);
         NRF_TIMER0->INTENSET = (TIMER_INTENSET_COMPARE0_Set<<TIMER_INTENSET_COMPARE0_Pos);
         mpsl_callback_signal = MPSL_TIMESLOT_SIGNAL_START;
         NVIC_EnableIRQ(TIMER0_IRQn);
+
+        /* Don't wait for the thread to be scheduled before arming the radio. */
+        if (p_timeslot_callbacks->fast_start) {
+            p_timeslot_callbacks->fast_start();
+        }
         NVIC_SetPendingIRQ(TIMESLOT_IRQN);
         break;
 
@@ -125,6 +204,12 @@ mpsl_cb(mpsl_timeslot_session_id_t session_id, uint32_t signal)
 #if TS_GPIO_DEBUG
         nrf_gpio_pin_write(TIMESLOT_OPEN_PIN, 0);
 #endif
+        /* Stop the radio while the timeslot is still open, the end callback runs after it. */
+        if (p_timeslot_callbacks->fast_end) {
+            p_timeslot_callbacks->fast_end();
+            NRF_TIMER0->TASKS_CAPTURE[1] = 1;
+            fast_end_us = NRF_TIMER0->CC[1] - NRF_TIMER0->CC[0];
+        }
         NRF_TIMER0->TASKS_STOP = 1;
         mpsl_callback_signal   = MPSL_TIMESLOT_SIGNAL_TIMER0;
         NVIC_SetPendingIRQ(TIMESLOT_IRQN);
@@ -183,6 +268,8 @@ mpsl_cb(mpsl_timeslot_session_id_t session_id, uint32_t signal)
 
 static void radio_notify_cb(const void *context)
 {
+    uint32_t now = k_cycle_get_32();
+
     if (!timeslot_started)
     {
         /* Ignore RNH events until the timeslot is started. */
@@ -193,6 +280,7 @@ static void radio_notify_cb(const void *context)
         /* This is an MPSL callback. */
         switch (mpsl_callback_signal) {
         case MPSL_TIMESLOT_SIGNAL_START:
+            start_cyc = now;
             k_poll_signal_raise(&timeslot_sig, SIGNAL_CODE_START);
             break;
         case MPSL_TIMESLOT_SIGNAL_RADIO:
@@ -217,10 +305,317 @@ static void radio_notify_cb(const void *context)
         nrf_gpio_pin_set(RADIO_NOTIFICATION_PIN);
         nrf_gpio_pin_clear(RADIO_NOTIFICATION_PIN);
 #endif
+        rnh_cyc = now;
         k_poll_signal_raise(&timeslot_sig, SIGNAL_CODE_RNH_ACTIVE);
     }
 }
 
+#if defined(CONFIG_SETTINGS)
+static int timeslot_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                                    void *cb_arg)
+{
+    struct timeslot_calibration cal;
+    int                         err;
+
+    if (strcmp(name, "cal") || (sizeof(cal) != len)) {
+        return -ENOENT;
+    }
+
+    err = read_cb(cb_arg, &cal, sizeof(cal));
+    if (err < 0) {
+        return err;
+    }
+
+    if ((cal.request_delay_us < TS_CAL_REQUEST_DELAY_MIN_US) ||
+        (cal.request_delay_us > TS_CAL_REQUEST_DELAY_MAX_US) ||
+        (cal.safety_margin_us < TS_CAL_SAFETY_MARGIN_MIN_US)) {
+        /* Ignore values that the calibration could not have produced. */
+        return -EINVAL;
+    }
+
+    request_delay_us = cal.request_delay_us;
+    safety_margin_us = cal.safety_margin_us;
+    end_max_us       = cal.safety_margin_us - TS_CAL_GUARD_US;
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(timeslot, "timeslot", NULL, timeslot_settings_set, NULL, NULL);
+#endif
+
+static void calibrate_request_delay(void)
+{
+    int32_t late_us;
+    int32_t delay_us;
+
+    if (!p_timeslot_config->calibrate) {
+        return;
+    }
+
+    /* The timeslot is supposed to start right after the longest possible Connection Event. */
+    late_us = (int32_t)k_cyc_to_us_floor32(start_cyc - request_rnh_cyc) -
+                  (TS_RNH_DISTANCE_US + CONFIG_SDC_MAX_CONN_EVENT_LEN_DEFAULT + request_shift_us);
+
+    if (late_us > TS_CAL_TOLERANCE_US) {
+        delay_us = (int32_t)request_delay_us + late_us;
+    } else {
+        /* Keep probing for the smallest delay that still starts the timeslot on time. */
+        delay_us = (int32_t)request_delay_us - TS_CAL_STEP_US;
+    }
+    delay_us = MAX(delay_us, TS_CAL_REQUEST_DELAY_MIN_US);
+    delay_us = MIN(delay_us, TS_CAL_REQUEST_DELAY_MAX_US);
+
+    request_delay_us  = (uint32_t)delay_us;
+    calibration_dirty = true;
+}
+
+static void calibrate_safety_margin(void)
+{
+    /* Only fast_end runs inside the timeslot, the end callback runs after it closed. */
+    if (!p_timeslot_config->calibrate || !p_timeslot_callbacks->fast_end) {
+        return;
+    }
+
+    /* Let the worst case decay slowly so that a single outlier doesn't stick forever. */
+    end_max_us       = MAX(fast_end_us, end_max_us - (end_max_us >> TS_CAL_DECAY_SHIFT));
+    safety_margin_us = MAX(end_max_us + TS_CAL_GUARD_US, TS_CAL_SAFETY_MARGIN_MIN_US);
+    safety_margin_us = MIN(safety_margin_us, ts_len_us / 2);
+
+    calibration_dirty = true;
+}
+
+static void stats_window_update(uint32_t airtime_us)
+{
+    uint32_t now_ms = k_uptime_get_32();
+
+    if ((now_ms - window_start_ms) >= TS_STATS_WINDOW_MS) {
+        if (window_requests) {
+            stats.min_window_airtime_us = MIN(stats.min_window_airtime_us, window_airtime_us);
+        }
+        window_start_ms   = now_ms;
+        window_airtime_us = 0;
+        window_requests   = 0;
+    }
+    window_airtime_us += airtime_us;
+}
+
+static void policy_granted(void)
+{
+    stats.granted++;
+    stats_window_update(ts_len_us - MIN(safety_margin_us, ts_len_us));
+
+    if ((POLICY_LEVEL_NORMAL != policy_level) && (++granted_streak >= TS_POLICY_RELAX_COUNT)) {
+        policy_level--;
+        granted_streak = 0;
+    }
+}
+
+static void policy_skipped(void)
+{
+    uint8_t level;
+
+    stats.skipped++;
+    stats.max_consecutive_skipped = MAX(stats.max_consecutive_skipped,
+                                            blocked_cancelled_count);
+    stats_window_update(0);
+    granted_streak = 0;
+
+    if (0 == p_timeslot_config->escalation_step) {
+        return;
+    }
+    level        = MIN(blocked_cancelled_count / p_timeslot_config->escalation_step,
+                           POLICY_LEVEL_HIGH);
+    policy_level = MAX(policy_level, level);
+    stats.max_policy_level = MAX(stats.max_policy_level, policy_level);
+}
+
+/* Applies the current policy level to the request and returns the length to request. */
+static uint32_t policy_apply(uint32_t len_us)
+{
+    if (policy_level >= POLICY_LEVEL_SHORTEN) {
+        len_us = MIN(len_us, MAX(len_us / 2, TS_POLICY_MIN_LEN_US));
+    }
+    request_shift_us = (policy_level >= POLICY_LEVEL_SHIFT) ? TS_POLICY_SHIFT_US : 0;
+    request_earliest.params.earliest.priority = (policy_level >= POLICY_LEVEL_HIGH) ?
+                                                    MPSL_TIMESLOT_PRIORITY_HIGH :
+                                                    MPSL_TIMESLOT_PRIORITY_NORMAL;
+    return len_us;
+}
+
+int timeslot_stats_get(struct timeslot_stats *p_stats)
+{
+    if (0 == p_stats) {
+        return -TIMESLOT_ERROR_INVALID_PARAM;
+    }
+
+    *p_stats              = stats;
+    p_stats->policy_level = policy_level;
+    return 0;
+}
+
+int timeslot_calibration_get(struct timeslot_calibration *p_cal)
+{
+    if (0 == p_cal) {
+        return -TIMESLOT_ERROR_INVALID_PARAM;
+    }
+
+    p_cal->request_delay_us = request_delay_us;
+    p_cal->safety_margin_us = safety_margin_us;
+    return 0;
+}
+
+int timeslot_link_add(uint8_t id, uint32_t interval_us)
+{
+    unsigned int key;
+
+    if (id >= TIMESLOT_MAX_LINKS) {
+        return -TIMESLOT_ERROR_INVALID_LINK;
+    }
+    if (0 == interval_us) {
+        return -TIMESLOT_ERROR_INVALID_PARAM;
+    }
+
+    key = irq_lock();
+    links[id].interval_cyc = k_us_to_cyc_near32(interval_us);
+    links[id].synced       = false;
+    irq_unlock(key);
+    return 0;
+}
+
+int timeslot_link_remove(uint8_t id)
+{
+    if (id >= TIMESLOT_MAX_LINKS) {
+        return -TIMESLOT_ERROR_INVALID_LINK;
+    }
+
+    links[id].interval_cyc = 0;
+    links[id].synced       = false;
+    return 0;
+}
+
+/* Matches a radio event to a link (or synchronizes a link to it). */
+static void links_track(uint32_t anchor_cyc)
+{
+    uint32_t     tolerance_cyc = k_us_to_cyc_ceil32(TS_LINK_TOLERANCE_US);
+    struct link *p_unsynced    = 0;
+    unsigned int key           = irq_lock();
+
+    for (int i = 0; i < TIMESLOT_MAX_LINKS; i++) {
+        struct link *p_link = &links[i];
+        uint32_t     elapsed_cyc;
+        uint32_t     error_cyc;
+        uint32_t     events;
+
+        if (0 == p_link->interval_cyc) {
+            continue;
+        }
+        if (!p_link->synced) {
+            p_unsynced = p_unsynced ? p_unsynced : p_link;
+            continue;
+        }
+
+        /* Find the distance to the closest predicted anchor point. */
+        elapsed_cyc = anchor_cyc - p_link->anchor_cyc;
+        events      = (elapsed_cyc + (p_link->interval_cyc / 2)) / p_link->interval_cyc;
+        error_cyc   = elapsed_cyc - (events * p_link->interval_cyc);
+        if ((error_cyc <= tolerance_cyc) || (error_cyc >= (0 - tolerance_cyc))) {
+            p_link->anchor_cyc = anchor_cyc;
+            irq_unlock(key);
+            return;
+        }
+        if (events > TS_LINK_RESYNC_EVENTS) {
+            p_link->synced = false;
+        }
+    }
+
+    /* Unknown event, e.g. a new link or advertising. */
+    if (p_unsynced) {
+        p_unsynced->anchor_cyc = anchor_cyc;
+        p_unsynced->synced     = true;
+    }
+    irq_unlock(key);
+}
+
+/*
+ * Returns the free time between the end of the radio event at anchor_cyc and the next
+ * predicted anchor point of any link, or UINT32_MAX if no links are tracked.
+ */
+static uint32_t links_gap_us(uint32_t anchor_cyc)
+{
+    uint32_t     tolerance_cyc = k_us_to_cyc_ceil32(TS_LINK_TOLERANCE_US);
+    uint32_t     next_cyc      = UINT32_MAX;
+    uint32_t     busy_us;
+    uint32_t     next_us;
+    unsigned int key           = irq_lock();
+
+    for (int i = 0; i < TIMESLOT_MAX_LINKS; i++) {
+        struct link *p_link = &links[i];
+        uint32_t     until_cyc;
+
+        if ((0 == p_link->interval_cyc) || !p_link->synced) {
+            continue;
+        }
+
+        until_cyc = p_link->interval_cyc -
+                        ((anchor_cyc - p_link->anchor_cyc) % p_link->interval_cyc);
+        if (until_cyc <= tolerance_cyc) {
+            /* This is (close to) the event that is about to start. */
+            until_cyc += p_link->interval_cyc;
+        }
+        next_cyc = MIN(next_cyc, until_cyc);
+    }
+    irq_unlock(key);
+
+    if (UINT32_MAX == next_cyc) {
+        return UINT32_MAX;
+    }
+
+    next_us = k_cyc_to_us_floor32(next_cyc);
+    busy_us = CONFIG_SDC_MAX_CONN_EVENT_LEN_DEFAULT + TS_LINK_GUARD_US;
+    return (next_us > busy_us) ? (next_us - busy_us) : 0;
+}
+
+static void need_len(uint32_t len_us)
+{
+    unsigned int key = irq_lock();
+
+    needed_len_us = MAX(needed_len_us, len_us);
+    irq_unlock(key);
+}
+
+int timeslot_need(uint32_t len_us)
+{
+    if (!session_open || !timeslot_started) {
+        return -TIMESLOT_ERROR_NO_TIMESLOT_STARTED;
+    }
+    need_len(len_us);
+    return 0;
+}
+
+/* Returns the length of the next timeslot or zero if it isn't needed. */
+static uint32_t next_request_len_us(void)
+{
+    uint32_t     len_us;
+    unsigned int key;
+
+    if (!p_timeslot_config->on_demand) {
+        return ts_max_len_us;
+    }
+
+    key           = irq_lock();
+    len_us        = needed_len_us;
+    needed_len_us = 0;
+    irq_unlock(key);
+
+    if (p_timeslot_callbacks->demand) {
+        len_us = MAX(len_us, p_timeslot_callbacks->demand());
+    }
+
+    if (0 == len_us) {
+        return 0;
+    }
+    return MIN(len_us + safety_margin_us, ts_max_len_us);
+}
+
 int timeslot_stop(void)
 {
     if (!session_open || !timeslot_started) {
@@ -239,9 +634,24 @@ int timeslot_start(uint32_t len_us)
 
     LOG_INF("timeslot_start(len_us: %d)", len_us);
     ts_len_us               = len_us;
+    ts_max_len_us           = len_us;
+    needed_len_us           = 0;
     blocked_cancelled_count = 0;
+    policy_level            = POLICY_LEVEL_NORMAL;
+    request_shift_us        = 0;
+    granted_streak          = 0;
+    window_start_ms         = k_uptime_get_32();
+    window_airtime_us       = 0;
+    window_requests         = 0;
     timeslot_started        = true;
 
+    memset(&stats, 0, sizeof(stats));
+    stats.min_window_airtime_us = UINT32_MAX;
+
+    for (int i = 0; i < TIMESLOT_MAX_LINKS; i++) {
+        links[i].synced = false;
+    }
+
     request_earliest.params.earliest.length_us = len_us;
     return 0;
 }
@@ -277,6 +687,9 @@ int timeslot_open(struct timeslot_config *p_config, struct timeslot_cb *p_cb)
     request_earliest.params.earliest.hfclk      = p_timeslot_config->hfclk;
     request_earliest.params.earliest.timeout_us = p_timeslot_config->timeout_us;
 
+    safety_margin_us = p_timeslot_config->safety_margin_us;
+    end_max_us       = p_timeslot_config->safety_margin_us;
+
 #if TS_GPIO_DEBUG
     nrf_gpio_cfg_output(TIMESLOT_OPEN_PIN);
     nrf_gpio_cfg_output(TIMESLOT_BLOCKED_PIN);
@@ -300,12 +713,29 @@ static void timeslot_stopped(void) {
 #endif
     timeslot_stopping = false;
     timeslot_started  = false;
+
+#if defined(CONFIG_SETTINGS)
+    if (calibration_dirty) {
+        struct timeslot_calibration cal;
+        int                         err;
+
+        (void)timeslot_calibration_get(&cal);
+        err = settings_save_one("timeslot/cal", &cal, sizeof(cal));
+        if (err) {
+            LOG_WRN("Could not save timeslot calibration (err=%d)", err);
+        }
+    }
+#endif
+    calibration_dirty = false;
     p_timeslot_callbacks->stopped();
 }
 
 static void timeslot_thread_fn(void)
 {
-    int err;
+    int      err;
+    uint32_t len_us;
+    uint32_t gap_us;
+    uint32_t anchor_cyc;
 
     while (true) {
         k_poll(events, 1, K_FOREVER);
@@ -314,10 +744,13 @@ static void timeslot_thread_fn(void)
         case SIGNAL_CODE_START:
             p_timeslot_callbacks->start();
             blocked_cancelled_count = 0;
+            policy_granted();
+            calibrate_request_delay();
             break;
 
         case SIGNAL_CODE_TIMER0:
             p_timeslot_callbacks->end();
+            calibrate_safety_margin();
             break;
 
 #if !TIMESLOT_CALLS_RADIO_IRQHANDLER
@@ -328,12 +761,19 @@ static void timeslot_thread_fn(void)
 
         case SIGNAL_CODE_BLOCKED_CANCELLED:
             timeslot_requested = false;
+            if (p_timeslot_config->on_demand) {
+                /* The demand that caused the request still has to be served. */
+                need_len(ts_len_us - MIN(safety_margin_us, ts_len_us));
+            }
 #if TS_GPIO_DEBUG
             nrf_gpio_pin_write(TIMESLOT_BLOCKED_PIN,   0);
             nrf_gpio_pin_write(TIMESLOT_CANCELLED_PIN, 0);
 #endif
             blocked_cancelled_count++;
+            policy_skipped();
             if (blocked_cancelled_count > p_timeslot_config->skipped_tolerance) {
+                /* Still a skipped timeslot, e.g. for the hopping sequence. */
+                p_timeslot_callbacks->skipped(blocked_cancelled_count);
                 blocked_cancelled_count = 0;
                 p_timeslot_callbacks->error(-TIMESLOT_ERROR_REQUESTS_FAILED);
                 break;
@@ -354,6 +794,11 @@ static void timeslot_thread_fn(void)
 
         case SIGNAL_CODE_OVERSTAYED:
             /* This is the most probable of the what-could-go-wrong scenarios. */
+            if (p_timeslot_config->calibrate) {
+                /* The margin was too optimistic; back off hard and converge again. */
+                end_max_us       = MIN(2 * safety_margin_us, ts_len_us / 2);
+                safety_margin_us = end_max_us;
+            }
             p_timeslot_callbacks->error(-TIMESLOT_ERROR_OVERSTAYED);
             break;
 
@@ -363,18 +808,41 @@ static void timeslot_thread_fn(void)
             break;
 
         case SIGNAL_CODE_RNH_ACTIVE:
+            anchor_cyc = rnh_cyc + k_us_to_cyc_near32(TS_RNH_DISTANCE_US);
+            links_track(anchor_cyc);
             if (timeslot_requested) {
                 break;
             }
+            len_us = next_request_len_us();
+            if (0 == len_us) {
+                /* Nothing to do, leave this Connection Interval to the BLE link. */
+                break;
+            }
+            len_us = policy_apply(len_us);
+            gap_us = links_gap_us(anchor_cyc);
+            gap_us = gap_us - MIN(request_shift_us, gap_us);
+            if (gap_us < TS_POLICY_MIN_LEN_US) {
+                /* Another link's event follows too closely, wait for the next gap. */
+                if (p_timeslot_config->on_demand) {
+                    need_len(len_us - MIN(safety_margin_us, len_us));
+                }
+                break;
+            }
+            len_us = MIN(len_us, gap_us);
+            window_requests++;
 #if TS_GPIO_DEBUG
             nrf_gpio_pin_write(REQUEST_PIN, 1);
 #endif
             k_sleep(K_USEC(CONFIG_SDC_MAX_CONN_EVENT_LEN_DEFAULT -
-                               TS_REQUEST_DELAY_US + TS_RNH_DISTANCE_US));
+                               request_delay_us + TS_RNH_DISTANCE_US + request_shift_us));
 #if TS_GPIO_DEBUG
             nrf_gpio_pin_write(REQUEST_PIN, 0);
 #endif
+            request_rnh_cyc    = rnh_cyc;
+            ts_len_us          = len_us;
             timeslot_requested = true;
+
+            request_earliest.params.earliest.length_us = len_us;
             err = mpsl_timeslot_request(mpsl_session_id, &request_earliest);
             if (err) {
                 p_timeslot_callbacks->error(err);
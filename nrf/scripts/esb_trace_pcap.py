@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2021 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+
+"""Convert an ESB packet trace to pcap.
+
+The input is the raw stream of struct esb_trace_record (see include/esb.h),
+for example an RTT up-buffer captured with JLinkRTTLogger after the device
+called esb_trace_drain_rtt(). Every record becomes one pcap packet holding the
+16-byte record, with link type LINKTYPE_USER0 so that a custom dissector can
+decode it. With --text the records are printed instead.
+"""
+
+import argparse
+import struct
+import sys
+
+RECORD = struct.Struct('<IHBBBBBbBBBB')
+LINKTYPE_USER0 = 147
+
+TYPES = ['STATE', 'TX', 'TX_FAILED', 'ACK_RX', 'RX', 'ACK_TX']
+FLAG_CRC_OK = 0x01
+
+
+def records(stream):
+    while True:
+        data = stream.read(RECORD.size)
+        if len(data) < RECORD.size:
+            return
+        yield data, RECORD.unpack(data)
+
+
+def times_us(recs, clock_hz):
+    """Unwrap the 32-bit system clock cycles into microseconds."""
+    high = 0
+    last = None
+    for data, rec in recs:
+        time = rec[0]
+        if last is not None and time < last:
+            high += 1 << 32
+        last = time
+        yield (high + time) * 1000000 // clock_hz, data, rec
+
+
+def write_pcap(out, recs, clock_hz):
+    out.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 65535,
+                          LINKTYPE_USER0))
+    for usec, data, _ in times_us(recs, clock_hz):
+        out.write(struct.pack('<IIII', usec // 1000000, usec % 1000000,
+                              len(data), len(data)))
+        out.write(data)
+
+
+def write_text(out, recs, clock_hz):
+    for usec, _, rec in times_us(recs, clock_hz):
+        (_, seq, rtype, state, pipe, pid, attempt, rssi, hdr0, hdr1, flags,
+         _) = rec
+        name = TYPES[rtype] if rtype < len(TYPES) else str(rtype)
+        out.write(f'{usec:>12} {seq:>5} {name:<9} state={state} '
+                  f'pipe={pipe} pid={pid} attempt={attempt} rssi={rssi} '
+                  f'hdr={hdr0:02x}{hdr1:02x} '
+                  f'crc={"ok" if flags & FLAG_CRC_OK else "-"}\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='binary trace capture')
+    parser.add_argument('output', nargs='?', help='pcap file, default stdout')
+    parser.add_argument('--clock-hz', type=int, default=32768,
+                        help='CONFIG_SYS_CLOCK_HW_CYCLES_PER_SEC of the device')
+    parser.add_argument('--text', action='store_true',
+                        help='print the records instead of writing pcap')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as stream:
+        recs = records(stream)
+        if args.text:
+            out = open(args.output, 'w') if args.output else sys.stdout
+            write_text(out, recs, args.clock_hz)
+        else:
+            out = (open(args.output, 'wb') if args.output
+                   else sys.stdout.buffer)
+            write_pcap(out, recs, args.clock_hz)
+
+
+if __name__ == '__main__':
+    main()
@@ -5,7 +5,10 @@
  */
 #include <errno.h>
 #include <irq.h>
+#include <kernel.h>
+#include <sys/atomic.h>
 #include <sys/byteorder.h>
+#include <sys/util.h>
 #include <nrf.h>
 #include <esb.h>
 #ifdef DPPI_PRESENT
@@ -17,6 +20,9 @@
 #include <stddef.h>
 #include <string.h>
 #include <nrf_erratas.h>
+#if defined(CONFIG_USE_SEGGER_RTT)
+#include <SEGGER_RTT.h>
+#endif
 
 /* Constants */
 
@@ -31,8 +37,15 @@
 /* 1 Mb RX wait for acknowledgment time-out (combined with BLE). */
 #define RX_ACK_TIMEOUT_US_1MBPS_BLE 300
 
-/* Minimum retransmit time */
-#define RETRANSMIT_DELAY_MIN 435
+/* Radio ramp-up time (TXEN/RXEN to READY) with the legacy and fast settings. */
+#define RAMP_UP_TIME_US_LEGACY 130
+#define RAMP_UP_TIME_US_FAST 40
+
+/* Minimum retransmit time. The retransmit TXEN (CC[1]) must fire after the
+ * longest RX wait for acknowledgment time-out (CC[0]) has disabled the radio.
+ */
+#define RETRANSMIT_DELAY_MIN(ramp_up_us)                                       \
+	(RX_ACK_TIMEOUT_US_1MBPS + (ramp_up_us) + 5)
 
 /* Interrupt flags */
 /* Interrupt mask value for TX success. */
@@ -52,6 +65,9 @@
  /* The maximum value for PID. */
 #define PID_MAX 3
 
+/* Value of tx_staged when no TX FIFO entry is staged. */
+#define TX_STAGED_NONE UINT32_MAX
+
 #define BIT_MASK_UINT_8(x) (0xFF >> (8 - (x)))
 
 #define RADIO_SHORTS_COMMON                                                    \
@@ -80,6 +96,85 @@
 #define ESB_SYS_TIMER_IRQn TIMER4_IRQn
 #endif
 
+/* The hardware retransmit loop (see esb_config.hw_retransmit) needs PPI
+ * channel groups, the RADIO CRCOK/CRCERROR events and a TIMER in counter mode.
+ */
+#if !defined(DPPI_PRESENT) && defined(RADIO_INTENSET_CRCOK_Msk) &&             \
+	(defined(ESB_HW_RETRANSMIT_TIMER) || defined(NRF_TIMER3))
+#define ESB_HW_RETRANSMIT_SUPPORTED 1
+#ifndef ESB_HW_RETRANSMIT_TIMER
+#define ESB_HW_RETRANSMIT_TIMER NRF_TIMER3
+#define ESB_HW_RETRANSMIT_TIMER_IRQn TIMER3_IRQn
+#endif
+#else
+#define ESB_HW_RETRANSMIT_SUPPORTED 0
+#endif
+
+/* Free-running timer that captures the RADIO ADDRESS event in CC[0] for the
+ * packet timestamps (see esb_config.timestamps).
+ */
+#if !defined(DPPI_PRESENT) && (defined(ESB_TIMESTAMP_TIMER) || defined(NRF_TIMER1))
+#define ESB_TIMESTAMP_SUPPORTED 1
+#ifndef ESB_TIMESTAMP_TIMER
+#define ESB_TIMESTAMP_TIMER NRF_TIMER1
+#endif
+#else
+#define ESB_TIMESTAMP_SUPPORTED 0
+#endif
+
+/* Specialized builds. Defining ESB_PTX_ONLY or ESB_PRX_ONLY to 1 fixes the
+ * mode, and ESB_DPL_ONLY fixes the protocol to ESB_PROTOCOL_ESB_DPL. The
+ * configuration checks on the radio path then fold at compile time and the
+ * code for the other mode or protocol is dropped. esb_init() rejects a
+ * configuration that does not match the build.
+ */
+#ifndef ESB_PTX_ONLY
+#define ESB_PTX_ONLY 0
+#endif
+#ifndef ESB_PRX_ONLY
+#define ESB_PRX_ONLY 0
+#endif
+#ifndef ESB_DPL_ONLY
+#define ESB_DPL_ONLY 0
+#endif
+
+#if ESB_PTX_ONLY && ESB_PRX_ONLY
+#error "ESB_PTX_ONLY and ESB_PRX_ONLY are mutually exclusive"
+#endif
+
+/* Define ESB_ISR_PROFILING to 1 to measure the interrupt handlers with the
+ * DWT cycle counter, see esb_get_profile() and esb_get_radio_isr_wcet().
+ * Without it the measurements are not compiled in and the cycle counter is
+ * left alone.
+ */
+#ifndef ESB_ISR_PROFILING
+#define ESB_ISR_PROFILING 0
+#endif
+
+#if ESB_ISR_PROFILING && !defined(DWT_CTRL_CYCCNTENA_Msk)
+#error "ESB_ISR_PROFILING needs the DWT cycle counter"
+#endif
+
+/* Define ESB_TRACE to 1 to record TX, RX and ACK frames in a ring buffer of
+ * ESB_TRACE_BUFFER_SIZE binary records, see esb_trace_read().
+ */
+#ifndef ESB_TRACE
+#define ESB_TRACE 0
+#endif
+#ifndef ESB_TRACE_BUFFER_SIZE
+#define ESB_TRACE_BUFFER_SIZE 128
+#endif
+
+#if ESB_TRACE && (ESB_TRACE_BUFFER_SIZE & (ESB_TRACE_BUFFER_SIZE - 1))
+#error "ESB_TRACE_BUFFER_SIZE must be a power of two"
+#endif
+
+#define ESB_MODE()							       \
+	(ESB_PTX_ONLY ? ESB_MODE_PTX :					       \
+	 ESB_PRX_ONLY ? ESB_MODE_PRX : esb_cfg.mode)
+#define ESB_PROTOCOL()							       \
+	(ESB_DPL_ONLY ? ESB_PROTOCOL_ESB_DPL : esb_cfg.protocol)
+
 /* Internal Enhanced ShockBurst module state. */
 enum esb_state {
 	ESB_STATE_IDLE,		/* Idle. */
@@ -91,6 +186,11 @@ enum esb_state {
 				 */
 	ESB_STATE_PRX,		/* Receiving packets without ACK. */
 	ESB_STATE_PRX_SEND_ACK, /* Transmitting ACK in RX mode. */
+	ESB_STATE_PRX_STOPPING, /* Waiting for the radio to be disabled after
+				 * esb_stop_rx().
+				 */
+	ESB_STATE_PTX_LBT,	   /* Sampling the RSSI before a packet. */
+	ESB_STATE_PTX_LBT_BACKOFF, /* Waiting for the channel to be clear. */
 };
 
 /* Pipe info PID and CRC and acknowledgment payload. */
@@ -102,6 +202,8 @@ struct pipe_info {
 			   * Used to detect retransmits.
 			   */
 	bool ack_payload; /* State of the transmission of ACK payloads. */
+	uint8_t burst_id; /* ID of the burst being received. */
+	uint16_t burst_rx; /* Frames of that burst received so far. */
 };
 
 /* Structure used by the PRX to organize ACK payloads for multiple pipes. */
@@ -176,13 +278,35 @@ static struct esb_payload *current_payload;
 /* FIFOs and buffers */
 static struct payload_tx_fifo tx_fifo;
 static struct payload_rx_fifo rx_fifo;
-static uint8_t tx_payload_buffer[CONFIG_ESB_MAX_PAYLOAD_LENGTH + 2];
 static uint8_t rx_payload_buffer[CONFIG_ESB_MAX_PAYLOAD_LENGTH + 2];
 
+/* Two TX buffers in radio format: while the current one is on air the next TX
+ * FIFO entry is copied into the other one, so the next transaction can start
+ * without a copy in the radio ISR.
+ */
+static uint8_t tx_payload_buffers[2][CONFIG_ESB_MAX_PAYLOAD_LENGTH + 2];
+static uint8_t *tx_payload_buffer = tx_payload_buffers[0];
+static uint32_t tx_buffer_idx;
+/* TX FIFO index that has been copied into the idle TX buffer. */
+static volatile uint32_t tx_staged = TX_STAGED_NONE;
+
 /* Random access buffer variables for ACK payload handling */
 struct payload_wrap ack_pl_wrap[CONFIG_ESB_TX_FIFO_SIZE];
 struct payload_wrap *ack_pl_wrap_pipe[CONFIG_ESB_PIPE_COUNT];
 
+/* ACK frames in radio format for the first two ACK payloads of each pipe, so
+ * the PRX only has to point PACKETPTR at one before the ACK ramp-up ends.
+ * ack_frame_wrap tells which ACK payload each frame holds.
+ */
+static uint8_t ack_frames[CONFIG_ESB_PIPE_COUNT][2]
+			 [CONFIG_ESB_MAX_PAYLOAD_LENGTH + 2];
+static struct payload_wrap *ack_frame_wrap[CONFIG_ESB_PIPE_COUNT][2];
+static uint8_t ack_empty_frame[2];
+
+/* Link statistics. rssi_avg_q4 is the RSSI average with 4 fractional bits. */
+static struct esb_stats stats[CONFIG_ESB_PIPE_COUNT];
+static int32_t rssi_avg_q4[CONFIG_ESB_PIPE_COUNT];
+
 /* Run time variables */
 static uint8_t pids[CONFIG_ESB_PIPE_COUNT];
 static struct pipe_info rx_pipe_info[CONFIG_ESB_PIPE_COUNT];
@@ -190,6 +314,7 @@ static volatile uint32_t interrupt_flags;
 static volatile uint32_t retransmits_remaining;
 static volatile uint32_t last_tx_attempts;
 static volatile uint32_t wait_for_ack_timeout_us;
+static uint32_t ramp_up_time_us = RAMP_UP_TIME_US_LEGACY;
 
 static uint32_t radio_shorts_common = RADIO_SHORTS_COMMON;
 
@@ -207,19 +332,199 @@ static ppi_channel_t ppi_ch_timer_compare1_radio_txen;
 
 static uint32_t ppi_all_channels_mask;
 
+#if ESB_HW_RETRANSMIT_SUPPORTED
+/* After a TX, DISABLED starts the RX and the ACK timer once, then disables
+ * ppi_group_rx again. CC[1] re-enables it together with the retransmit.
+ */
+static nrf_ppi_channel_t ppi_ch_radio_disabled_radio_rxen;
+static nrf_ppi_channel_t ppi_ch_radio_disabled_group_rx_disable;
+static nrf_ppi_channel_t ppi_ch_timer_compare1_group_rx_enable;
+/* Stops further retransmits when the counter reaches retransmit_count. */
+static nrf_ppi_channel_t ppi_ch_counter_compare0_group_txen_disable;
+
+static nrf_ppi_channel_group_t ppi_group_rx;
+static nrf_ppi_channel_group_t ppi_group_txen;
+
+static uint32_t ppi_hw_retransmit_mask;
+static bool ppi_hw_retransmit_allocated;
+#endif
+
+#if ESB_TIMESTAMP_SUPPORTED
+static nrf_ppi_channel_t ppi_ch_radio_address_timestamp;
+static bool ppi_timestamp_allocated;
+#endif
+
+/* Listen before talk: READY -> RSSISTART and RSSIEND -> DISABLE. */
+static ppi_channel_t ppi_ch_radio_ready_rssistart;
+static ppi_channel_t ppi_ch_radio_rssiend_disable;
+static bool ppi_lbt_allocated;
+
 /* These function pointers are changed dynamically, depending on protocol
  * configuration and state. Note that they will be 0 initialized.
  */
 static void (*on_radio_disabled)(void);
 static void (*on_radio_end)(void);
-static void (*update_rf_payload_format)(uint32_t payload_length);
+
+static bool hw_retransmit;
+
+#if ESB_ISR_PROFILING
+/* Longest RADIO_IRQHandler run, in CPU cycles. */
+static uint32_t radio_isr_wcet;
+
+struct profile_data {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint32_t hist[ESB_PROFILE_HIST_BUCKETS];
+};
+
+static struct profile_data profile[ESB_PROFILE_COUNT];
+#endif
+
+#if ESB_TRACE
+/* Records are reserved with an atomic increment of trace_head, so the radio
+ * and event interrupts and the threads can all write without locking. The
+ * seq field is written last and tells the reader that a record is complete.
+ */
+static struct esb_trace_record trace_buffer[ESB_TRACE_BUFFER_SIZE];
+static atomic_t trace_head;
+static uint32_t trace_tail;
+#endif
+
+/* Burst mode. The burst header byte after the S1 byte holds the burst ID in
+ * the high nibble and the index of the frame in the burst in the low nibble.
+ * The last frame sent requests an ACK, which carries the bitmap of the frames
+ * of the burst that the PRX has received.
+ */
+#define BURST_HDR(id, index) (((id) << 4) | (index))
+#define BURST_HDR_ID(hdr) ((hdr) >> 4)
+#define BURST_HDR_INDEX(hdr) ((hdr) & 0x0F)
+
+static uint8_t burst_id;
+static uint8_t burst_count;	/* Frames in the burst, from the FIFO front. */
+static uint16_t burst_pending;	/* Frames not acknowledged yet. */
+static uint8_t burst_index;	/* Frame on air. */
+static uint8_t burst_ack_frame[4];
+
+/* Forward error correction. The FEC header byte after the S1 byte holds the
+ * group number in the high nibble and the index of the frame in the group in
+ * the low nibble. The parity frame that closes a group holds the XOR of the
+ * lengths and the data of its frames, which rebuilds one lost frame.
+ */
+#define FEC_HDR(group, index) (((group) << 4) | (index))
+#define FEC_HDR_GROUP(hdr) ((hdr) >> 4)
+#define FEC_HDR_INDEX(hdr) ((hdr) & 0x0F)
+#define FEC_INDEX_PARITY 0x0F
+#define FEC_DATA_MAX (CONFIG_ESB_MAX_PAYLOAD_LENGTH - 2)
+
+struct fec_state {
+	uint8_t group;
+	uint8_t index;		/* Next frame to send. */
+	uint8_t max_len;	/* Longest frame sent in the group. */
+	uint16_t received;	/* Frames of the group received. */
+	uint8_t parity[FEC_DATA_MAX + 1]; /* Length, then data. */
+};
+
+static struct fec_state fec[CONFIG_ESB_PIPE_COUNT];
+static struct esb_payload fec_frame;
+static uint8_t fec_rx_buffer[CONFIG_ESB_MAX_PAYLOAD_LENGTH + 2];
+
+/* Rate adaptation, see esb_config.rate_adaptation. A PTX steps down after a
+ * failed packet or ESB_RATE_DOWN_COUNT packets in a row that needed more than
+ * ESB_RATE_DOWN_ATTEMPTS attempts, and up after ESB_RATE_UP_COUNT packets in
+ * a row sent at the first attempt with an ACK stronger than ESB_RATE_UP_RSSI
+ * (-dBm). A PRX without traffic moves to the next rate every
+ * ESB_RATE_HUNT_DWELL_US.
+ */
+#ifndef ESB_RATE_DOWN_ATTEMPTS
+#define ESB_RATE_DOWN_ATTEMPTS 2
+#endif
+#ifndef ESB_RATE_DOWN_COUNT
+#define ESB_RATE_DOWN_COUNT 4
+#endif
+#ifndef ESB_RATE_UP_COUNT
+#define ESB_RATE_UP_COUNT 32
+#endif
+#ifndef ESB_RATE_UP_RSSI
+#define ESB_RATE_UP_RSSI 75
+#endif
+#ifndef ESB_RATE_HUNT_DWELL_US
+#define ESB_RATE_HUNT_DWELL_US 5000
+#endif
+
+static const enum esb_bitrate rate_ladder[] = {
+	ESB_BITRATE_2MBPS,
+	ESB_BITRATE_1MBPS,
+	ESB_BITRATE_1MBPS_BLE,
+};
+
+struct rate_state {
+	uint8_t idx;	/* Rate in rate_ladder. */
+	uint8_t bad;	/* Packets in a row that needed retransmits. */
+	uint8_t good;	/* Clean packets in a row with a strong ACK. */
+};
+
+static struct rate_state rate[CONFIG_ESB_PIPE_COUNT];
+static uint8_t rate_hunt_idx;
+
+/* TX power control, see esb_config.tx_power_control. The ACK RSSI, taken at
+ * the PRX's tx_output_power, gives the path loss. The PTX uses the lowest
+ * power at which its packets still reach the PRX at ESB_TX_POWER_TARGET_RSSI
+ * (-dBm) or stronger, and only lowers it when the next step down still keeps
+ * ESB_TX_POWER_HYSTERESIS dB of margin. A failed packet restores full power.
+ */
+#ifndef ESB_TX_POWER_TARGET_RSSI
+#define ESB_TX_POWER_TARGET_RSSI 75
+#endif
+#ifndef ESB_TX_POWER_HYSTERESIS
+#define ESB_TX_POWER_HYSTERESIS 4
+#endif
+
+static const struct {
+	enum esb_tx_power power;
+	int8_t dbm;
+} tx_power_ladder[] = {
+#if !defined(CONFIG_SOC_NRF5340_CPUNET)
+	{ ESB_TX_POWER_4DBM, 4 },
+#endif
+#if defined(CONFIG_SOC_SERIES_NRF52X)
+	{ ESB_TX_POWER_3DBM, 3 },
+#endif
+	{ ESB_TX_POWER_0DBM, 0 },
+	{ ESB_TX_POWER_NEG4DBM, -4 },
+	{ ESB_TX_POWER_NEG8DBM, -8 },
+	{ ESB_TX_POWER_NEG12DBM, -12 },
+	{ ESB_TX_POWER_NEG16DBM, -16 },
+	{ ESB_TX_POWER_NEG20DBM, -20 },
+	{ ESB_TX_POWER_NEG30DBM, -30 },
+	{ ESB_TX_POWER_NEG40DBM, -40 },
+};
+
+static uint8_t tx_power_idx[CONFIG_ESB_PIPE_COUNT];
+static uint8_t tx_power_max_idx;
+
+/* Listen before talk, see esb_config.lbt_threshold. */
+static uint8_t lbt_backoffs;
+static uint32_t lbt_rand;
+/* The channel was just found clear, start_tx_transaction() sends at once. */
+static bool lbt_clear;
+
+static bool timestamps;
+static volatile uint32_t last_tx_timestamp;
+static volatile uint32_t last_ack_timestamp;
 
 /*  The following functions are assigned to the function pointers above. */
 static void on_radio_disabled_tx_noack(void);
+static void on_radio_disabled_tx_burst(void);
 static void on_radio_disabled_tx(void);
 static void on_radio_disabled_tx_wait_for_ack(void);
 static void on_radio_disabled_rx(void);
 static void on_radio_disabled_rx_ack(void);
+static void on_radio_disabled_rx_restart(void);
+static void on_radio_disabled_rx_stopped(void);
+static void on_radio_disabled_rx_rate(void);
+static void on_tx_ack_received(const uint8_t *ack_buffer);
 
 /*  Function to do bytewise bit-swap on an unsigned 32-bit value */
 static uint32_t bytewise_bit_swap(const uint8_t *input)
@@ -319,6 +624,15 @@ static void update_rf_payload_format_esb(uint32_t payload_length)
 		(payload_length << RADIO_PCNF1_MAXLEN_Pos);
 }
 
+static inline void update_rf_payload_format(uint32_t payload_length)
+{
+	if (ESB_PROTOCOL() == ESB_PROTOCOL_ESB_DPL) {
+		update_rf_payload_format_esb_dpl(payload_length);
+	} else {
+		update_rf_payload_format_esb(payload_length);
+	}
+}
+
 static void update_radio_addresses(uint8_t update_mask)
 {
 	if ((update_mask & ADDR_UPDATE_MASK_BASE0) != 0) {
@@ -348,13 +662,98 @@ static void update_radio_tx_power(void)
 {
 	NRF_RADIO->TXPOWER = esb_cfg.tx_output_power
 			     << RADIO_TXPOWER_TXPOWER_Pos;
+
+	tx_power_max_idx = 0;
+	for (int i = 0; i < ARRAY_SIZE(tx_power_ladder); i++) {
+		if (tx_power_ladder[i].power == esb_cfg.tx_output_power) {
+			tx_power_max_idx = i;
+			break;
+		}
+	}
+	/* Keep the powers learned so far, but never above tx_output_power. */
+	for (int i = 0; i < ARRAY_SIZE(tx_power_idx); i++) {
+		tx_power_idx[i] = MAX(tx_power_idx[i], tx_power_max_idx);
+	}
 }
 
-static bool update_radio_bitrate(void)
+/* Restart every pipe from tx_output_power, after it changed. */
+static void tx_power_reset(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(tx_power_idx); i++) {
+		tx_power_idx[i] = tx_power_max_idx;
+	}
+}
+
+static void tx_power_tx_start(uint8_t pipe)
+{
+	if (esb_cfg.tx_power_control) {
+		NRF_RADIO->TXPOWER = tx_power_ladder[tx_power_idx[pipe]].power
+				     << RADIO_TXPOWER_TXPOWER_Pos;
+	}
+}
+
+/* Account for a completed transaction, on success the RSSI of the ACK is
+ * still in RSSISAMPLE.
+ */
+static void tx_power_tx_done(uint8_t pipe, bool success)
+{
+	uint8_t *idx = &tx_power_idx[pipe];
+	int path_loss;
+
+	if (!esb_cfg.tx_power_control) {
+		return;
+	}
+
+	if (!success) {
+		*idx = tx_power_max_idx;
+		return;
+	}
+
+	path_loss = tx_power_ladder[tx_power_max_idx].dbm +
+		    (int)NRF_RADIO->RSSISAMPLE;
+
+	/* Our packets arrive at dbm - path_loss, which must be at least
+	 * -ESB_TX_POWER_TARGET_RSSI.
+	 */
+	if (tx_power_ladder[*idx].dbm - path_loss < -ESB_TX_POWER_TARGET_RSSI) {
+		while (*idx > tx_power_max_idx &&
+		       tx_power_ladder[*idx].dbm - path_loss <
+		       -ESB_TX_POWER_TARGET_RSSI) {
+			(*idx)--;
+		}
+	} else if (*idx < ARRAY_SIZE(tx_power_ladder) - 1 &&
+		   tx_power_ladder[*idx + 1].dbm - path_loss >=
+		   -ESB_TX_POWER_TARGET_RSSI + ESB_TX_POWER_HYSTERESIS) {
+		(*idx)++;
+	}
+}
+
+static bool update_radio_ramp_up(void)
+{
+#if defined(RADIO_MODECNF0_RU_Msk)
+	NRF_RADIO->MODECNF0 = (NRF_RADIO->MODECNF0 & ~RADIO_MODECNF0_RU_Msk) |
+			      ((esb_cfg.fast_ramp_up ? RADIO_MODECNF0_RU_Fast :
+						       RADIO_MODECNF0_RU_Default)
+			       << RADIO_MODECNF0_RU_Pos);
+	ramp_up_time_us = esb_cfg.fast_ramp_up ? RAMP_UP_TIME_US_FAST :
+						 RAMP_UP_TIME_US_LEGACY;
+	return true;
+#else
+	ramp_up_time_us = RAMP_UP_TIME_US_LEGACY;
+	return !esb_cfg.fast_ramp_up;
+#endif
+}
+
+static bool radio_bitrate_set(enum esb_bitrate bitrate)
 {
-	NRF_RADIO->MODE = esb_cfg.bitrate << RADIO_MODE_MODE_Pos;
+	NRF_RADIO->MODE = bitrate << RADIO_MODE_MODE_Pos;
 
-	switch (esb_cfg.bitrate) {
+	/* The time-outs are counted from our RX READY. They are not reduced for
+	 * fast ramp-up because a legacy PRX starts its ACK
+	 * RAMP_UP_TIME_US_LEGACY - RAMP_UP_TIME_US_FAST later relative to it,
+	 * which they already cover.
+	 */
+	switch (bitrate) {
 	case ESB_BITRATE_2MBPS:
 #if defined(CONFIG_SOC_SERIES_NRF52X) || defined(CONFIG_SOC_NRF5340_CPUNET)
 	case ESB_BITRATE_2MBPS_BLE:
@@ -384,22 +783,204 @@ static bool update_radio_bitrate(void)
 	return true;
 }
 
+static bool update_radio_bitrate(void)
+{
+	return radio_bitrate_set(esb_cfg.bitrate);
+}
+
+static int rate_ladder_index(enum esb_bitrate bitrate)
+{
+	for (int i = 0; i < ARRAY_SIZE(rate_ladder); i++) {
+		if (rate_ladder[i] == bitrate) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* Use the rate of the pipe for the next transaction. The radio is disabled
+ * between transactions, so MODE can be changed.
+ */
+static void rate_tx_start(uint8_t pipe)
+{
+	if (esb_cfg.rate_adaptation) {
+		(void)radio_bitrate_set(rate_ladder[rate[pipe].idx]);
+	}
+}
+
+/* Account for a completed transaction, on success the RSSI of the ACK is
+ * still in RSSISAMPLE.
+ */
+static void rate_tx_done(uint8_t pipe, uint32_t attempts, bool success)
+{
+	struct rate_state *r = &rate[pipe];
+
+	if (!esb_cfg.rate_adaptation) {
+		return;
+	}
+
+	if (!success || attempts > ESB_RATE_DOWN_ATTEMPTS) {
+		r->good = 0;
+		if ((!success || ++r->bad >= ESB_RATE_DOWN_COUNT) &&
+		    r->idx < ARRAY_SIZE(rate_ladder) - 1) {
+			r->idx++;
+			r->bad = 0;
+		}
+		return;
+	}
+
+	r->bad = 0;
+	if (attempts > 1 || NRF_RADIO->RSSISAMPLE >= ESB_RATE_UP_RSSI) {
+		r->good = 0;
+	} else if (++r->good >= ESB_RATE_UP_COUNT && r->idx > 0) {
+		r->idx--;
+		r->good = 0;
+	}
+}
+
+/* Raise ESB_SYS_TIMER_IRQHandler after a delay with CC[2]. Used by the PRX
+ * rate hunt and the PTX listen before talk backoff, when the timer is not
+ * running a transaction. CC[1] is moved out of the way of its CLEAR and STOP
+ * shorts.
+ */
+static void sys_timer_alarm_start(uint32_t delay_us)
+{
+	ESB_SYS_TIMER->TASKS_SHUTDOWN = 1;
+	ESB_SYS_TIMER->CC[1] = UINT16_MAX;
+	ESB_SYS_TIMER->CC[2] = MIN(delay_us, UINT16_MAX - 1);
+	ESB_SYS_TIMER->EVENTS_COMPARE[2] = 0;
+	ESB_SYS_TIMER->INTENSET = TIMER_INTENSET_COMPARE2_Msk;
+	ESB_SYS_TIMER->TASKS_CLEAR = 1;
+	ESB_SYS_TIMER->TASKS_START = 1;
+}
+
+static void sys_timer_alarm_stop(void)
+{
+	ESB_SYS_TIMER->INTENCLR = TIMER_INTENCLR_COMPARE2_Msk;
+	ESB_SYS_TIMER->TASKS_SHUTDOWN = 1;
+	ESB_SYS_TIMER->EVENTS_COMPARE[2] = 0;
+}
+
+/* Enable the receiver on a channel and wait until it is ready. */
+static void radio_rx_ready_wait(uint8_t channel)
+{
+	NRF_RADIO->FREQUENCY = channel;
+	NRF_RADIO->EVENTS_READY = 0;
+	NRF_RADIO->TASKS_RXEN = 1;
+	while (NRF_RADIO->EVENTS_READY == 0) {
+	}
+	NRF_RADIO->EVENTS_READY = 0;
+}
+
+static uint8_t radio_rssi_sample(void)
+{
+	NRF_RADIO->EVENTS_RSSIEND = 0;
+	NRF_RADIO->TASKS_RSSISTART = 1;
+	while (NRF_RADIO->EVENTS_RSSIEND == 0) {
+	}
+	NRF_RADIO->EVENTS_RSSIEND = 0;
+
+	return NRF_RADIO->RSSISAMPLE;
+}
+
+static void radio_disable_wait(void)
+{
+	NRF_RADIO->EVENTS_DISABLED = 0;
+	NRF_RADIO->TASKS_DISABLE = 1;
+	while (NRF_RADIO->EVENTS_DISABLED == 0) {
+	}
+	NRF_RADIO->EVENTS_DISABLED = 0;
+}
+
+/* Back off with a random number of units in a window that doubles with every
+ * backoff, or fail the packet when they are used up.
+ */
+static void lbt_backoff(uint8_t pipe)
+{
+	uint32_t window;
+
+	if (lbt_backoffs >= esb_cfg.lbt_max_backoffs) {
+		lbt_backoffs = 0;
+		last_tx_attempts = 0;
+		interrupt_flags |= INT_TX_FAILED_MSK;
+		stats[pipe].tx_failed++;
+		esb_state = ESB_STATE_IDLE;
+		NVIC_SetPendingIRQ(ESB_EVT_IRQ);
+		return;
+	}
+
+	/* xorshift32 */
+	lbt_rand ^= lbt_rand << 13;
+	lbt_rand ^= lbt_rand >> 17;
+	lbt_rand ^= lbt_rand << 5;
+
+	window = BIT(MIN(lbt_backoffs, 10) + 1);
+	lbt_backoffs++;
+
+	esb_state = ESB_STATE_PTX_LBT_BACKOFF;
+	sys_timer_alarm_start(esb_cfg.lbt_backoff_us *
+			      (1 + lbt_rand % window));
+}
+
+static void lbt_ppi_enable(void)
+{
+	if (!ppi_lbt_allocated) {
+#ifdef DPPI_PRESENT
+		nrfx_dppi_channel_alloc(&ppi_ch_radio_ready_rssistart);
+		nrfx_dppi_channel_alloc(&ppi_ch_radio_rssiend_disable);
+#else
+		nrfx_ppi_channel_alloc(&ppi_ch_radio_ready_rssistart);
+		nrfx_ppi_channel_alloc(&ppi_ch_radio_rssiend_disable);
+
+		nrfx_ppi_channel_assign(ppi_ch_radio_ready_rssistart,
+			(uint32_t)&NRF_RADIO->EVENTS_READY, (uint32_t)&NRF_RADIO->TASKS_RSSISTART);
+		nrfx_ppi_channel_assign(ppi_ch_radio_rssiend_disable,
+			(uint32_t)&NRF_RADIO->EVENTS_RSSIEND, (uint32_t)&NRF_RADIO->TASKS_DISABLE);
+#endif
+		ppi_lbt_allocated = true;
+	}
+
+#ifdef DPPI_PRESENT
+	/* READY and DISABLE are borrowed from the ACK timer channels. */
+	NRF_RADIO->PUBLISH_READY       = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_ready_rssistart;
+	NRF_RADIO->SUBSCRIBE_RSSISTART = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_ready_rssistart;
+	NRF_RADIO->PUBLISH_RSSIEND     = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_rssiend_disable;
+	NRF_RADIO->SUBSCRIBE_DISABLE   = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_rssiend_disable;
+#endif
+	nrfx_gppi_channels_enable((1 << ppi_ch_radio_ready_rssistart) |
+				  (1 << ppi_ch_radio_rssiend_disable));
+}
+
+static void lbt_ppi_disable(void)
+{
+	if (!ppi_lbt_allocated) {
+		return;
+	}
+
+	nrfx_gppi_channels_disable((1 << ppi_ch_radio_ready_rssistart) |
+				   (1 << ppi_ch_radio_rssiend_disable));
+#ifdef DPPI_PRESENT
+	NRF_RADIO->SUBSCRIBE_RSSISTART = 0;
+	NRF_RADIO->PUBLISH_RSSIEND     = 0;
+	NRF_RADIO->PUBLISH_READY       = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_ready_timer_start;
+	NRF_RADIO->SUBSCRIBE_DISABLE   = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_timer_compare0_radio_disable;
+#endif
+}
+
 static bool update_radio_protocol(void)
 {
 	switch (esb_cfg.protocol) {
 	case ESB_PROTOCOL_ESB_DPL:
-		update_rf_payload_format = update_rf_payload_format_esb_dpl;
-		break;
+		return true;
 
 	case ESB_PROTOCOL_ESB:
-		update_rf_payload_format = update_rf_payload_format_esb;
-		break;
+		return !ESB_DPL_ONLY;
 
 	default:
 		/* Should not be reached */
 		return false;
 	}
-	return true;
 }
 
 static bool update_radio_crc(void)
@@ -434,12 +1015,13 @@ static bool update_radio_parameters(void)
 	bool params_valid = true;
 
 	update_radio_tx_power();
+	params_valid &= update_radio_ramp_up();
 	params_valid &= update_radio_bitrate();
 	params_valid &= update_radio_protocol();
 	params_valid &= update_radio_crc();
 	update_rf_payload_format(esb_cfg.payload_length);
 	params_valid &=
-	    (esb_cfg.retransmit_delay >= RETRANSMIT_DELAY_MIN);
+	    (esb_cfg.retransmit_delay >= RETRANSMIT_DELAY_MIN(ramp_up_time_us));
 
 	return params_valid;
 }
@@ -453,6 +1035,27 @@ static void reset_fifos(void)
 	rx_fifo.back = 0;
 	rx_fifo.front = 0;
 	rx_fifo.count = 0;
+
+	tx_staged = TX_STAGED_NONE;
+	memset(ack_frame_wrap, 0, sizeof(ack_frame_wrap));
+}
+
+static void stats_tx_done(uint32_t pipe, uint32_t attempts)
+{
+	uint32_t bucket = MIN(attempts - 1, ESB_STATS_RETRANSMIT_BUCKETS - 1);
+
+	stats[pipe].tx_packets++;
+	stats[pipe].retransmits[bucket]++;
+}
+
+static void stats_rx_done(uint32_t pipe, int8_t rssi)
+{
+	if (stats[pipe].rx_packets++ == 0) {
+		rssi_avg_q4[pipe] = rssi * 16;
+	} else {
+		rssi_avg_q4[pipe] += (rssi * 16 - rssi_avg_q4[pipe]) / 8;
+	}
+	stats[pipe].rssi_avg = rssi_avg_q4[pipe] / 16;
 }
 
 static void initialize_fifos(void)
@@ -497,43 +1100,101 @@ static void tx_fifo_remove_last(void)
 	irq_unlock(key);
 }
 
+static void timestamp_init(void)
+{
+#if ESB_TIMESTAMP_SUPPORTED
+	if (!timestamps) {
+		return;
+	}
+
+	if (!ppi_timestamp_allocated) {
+		nrfx_ppi_channel_alloc(&ppi_ch_radio_address_timestamp);
+		ppi_timestamp_allocated = true;
+	}
+
+	ESB_TIMESTAMP_TIMER->TASKS_STOP = 1;
+	ESB_TIMESTAMP_TIMER->MODE = TIMER_MODE_MODE_Timer;
+	ESB_TIMESTAMP_TIMER->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+	ESB_TIMESTAMP_TIMER->PRESCALER = 4; /* 1 MHz */
+	ESB_TIMESTAMP_TIMER->SHORTS = 0;
+	ESB_TIMESTAMP_TIMER->INTENCLR = 0xFFFFFFFF;
+	ESB_TIMESTAMP_TIMER->TASKS_CLEAR = 1;
+	ESB_TIMESTAMP_TIMER->TASKS_START = 1;
+
+	nrfx_ppi_channel_assign(ppi_ch_radio_address_timestamp,
+		(uint32_t)&NRF_RADIO->EVENTS_ADDRESS,
+		(uint32_t)&ESB_TIMESTAMP_TIMER->TASKS_CAPTURE[0]);
+	nrfx_gppi_channels_enable(1 << ppi_ch_radio_address_timestamp);
+#else
+	timestamps = false;
+#endif
+}
+
+static void timestamp_stop(void)
+{
+#if ESB_TIMESTAMP_SUPPORTED
+	if (timestamps) {
+		nrfx_gppi_channels_disable(1 << ppi_ch_radio_address_timestamp);
+		ESB_TIMESTAMP_TIMER->TASKS_STOP = 1;
+	}
+#endif
+}
+
+/* Time of the last RADIO ADDRESS event, read before the next one. */
+static inline uint32_t timestamp_address(void)
+{
+#if ESB_TIMESTAMP_SUPPORTED
+	return timestamps ? ESB_TIMESTAMP_TIMER->CC[0] : 0;
+#else
+	return 0;
+#endif
+}
+
 /*  Function to push the content of the rx_buffer to the RX FIFO.
  *
  *  The module will point the register NRF_RADIO->PACKETPTR to a buffer for
  *  receiving packets. After receiving a packet the module will call this
  *  function to copy the received data to the RX FIFO.
  *
- *  @param  pipe Pipe number to set for the packet.
- *  @param  pid  Packet ID.
+ *  @param  buffer Buffer the packet was received into.
+ *  @param  pipe   Pipe number to set for the packet.
+ *  @param  pid    Packet ID.
+ *  @param  skip   Number of header bytes before the payload data.
  *
  *  @retval true   Operation successful.
  *  @retval false  Operation failed.
  */
-static bool rx_fifo_push_rfbuf(uint8_t pipe, uint8_t pid)
+static bool rx_fifo_push_rfbuf(const uint8_t *buffer, uint8_t pipe,
+			       uint8_t pid, uint8_t skip)
 {
 	if (rx_fifo.count >= CONFIG_ESB_RX_FIFO_SIZE) {
+		stats[pipe].rx_overflows++;
 		return false;
 	}
 
-	if (esb_cfg.protocol == ESB_PROTOCOL_ESB_DPL) {
-		if (rx_payload_buffer[0] > CONFIG_ESB_MAX_PAYLOAD_LENGTH) {
+	if (ESB_PROTOCOL() == ESB_PROTOCOL_ESB_DPL) {
+		if (buffer[0] > CONFIG_ESB_MAX_PAYLOAD_LENGTH ||
+		    buffer[0] < skip) {
+			stats[pipe].rx_length_errors++;
 			return false;
 		}
-		rx_fifo.payload[rx_fifo.back]->length = rx_payload_buffer[0];
-	} else if (esb_cfg.mode == ESB_MODE_PTX) {
+		rx_fifo.payload[rx_fifo.back]->length = buffer[0] - skip;
+	} else if (ESB_MODE() == ESB_MODE_PTX) {
 		/* Received packet is an acknowledgment */
 		rx_fifo.payload[rx_fifo.back]->length = 0;
 	} else {
 		rx_fifo.payload[rx_fifo.back]->length = esb_cfg.payload_length;
 	}
 
-	memcpy(rx_fifo.payload[rx_fifo.back]->data, &rx_payload_buffer[2],
+	memcpy(rx_fifo.payload[rx_fifo.back]->data, &buffer[2 + skip],
 	       rx_fifo.payload[rx_fifo.back]->length);
 
 	rx_fifo.payload[rx_fifo.back]->pipe = pipe;
 	rx_fifo.payload[rx_fifo.back]->rssi = NRF_RADIO->RSSISAMPLE;
 	rx_fifo.payload[rx_fifo.back]->pid = pid;
-	rx_fifo.payload[rx_fifo.back]->noack = !(rx_payload_buffer[1] & 0x01);
+	rx_fifo.payload[rx_fifo.back]->noack = !(buffer[1] & 0x01);
+	rx_fifo.payload[rx_fifo.back]->timestamp = timestamp_address();
+	stats_rx_done(pipe, rx_fifo.payload[rx_fifo.back]->rssi);
 
 	if (++rx_fifo.back >= CONFIG_ESB_RX_FIFO_SIZE) {
 		rx_fifo.back = 0;
@@ -552,6 +1213,19 @@ static void sys_timer_init(void)
 				TIMER_SHORTS_COMPARE1_STOP_Msk;
 }
 
+#ifdef DPPI_PRESENT
+/* Connect the RADIO to the ESB channels. Another user of the radio may have
+ * changed this, see esb_resume().
+ */
+static void dppi_radio_connect(void)
+{
+	NRF_RADIO->PUBLISH_READY          = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_ready_timer_start;
+	NRF_RADIO->PUBLISH_ADDRESS        = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_address_timer_stop;
+	NRF_RADIO->SUBSCRIBE_DISABLE      = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_timer_compare0_radio_disable;
+	NRF_RADIO->SUBSCRIBE_TXEN         = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_timer_compare1_radio_txen;
+}
+#endif
+
 static void ppi_init(void)
 {
 #ifdef DPPI_PRESENT
@@ -560,14 +1234,11 @@ static void ppi_init(void)
 	nrfx_dppi_channel_alloc(&ppi_ch_timer_compare0_radio_disable);
 	nrfx_dppi_channel_alloc(&ppi_ch_timer_compare1_radio_txen);
 
-	NRF_RADIO->PUBLISH_READY          = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_ready_timer_start;
 	ESB_SYS_TIMER->SUBSCRIBE_START    = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_ready_timer_start;
-	NRF_RADIO->PUBLISH_ADDRESS        = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_address_timer_stop;
 	ESB_SYS_TIMER->SUBSCRIBE_SHUTDOWN = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_radio_address_timer_stop;
 	ESB_SYS_TIMER->PUBLISH_COMPARE[0] = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_timer_compare0_radio_disable;
-	NRF_RADIO->SUBSCRIBE_DISABLE      = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_timer_compare0_radio_disable;
 	ESB_SYS_TIMER->PUBLISH_COMPARE[1] = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_timer_compare1_radio_txen;
-	NRF_RADIO->SUBSCRIBE_TXEN         = DPPIC_SUBSCRIBE_CHG_EN_EN_Msk | ppi_ch_timer_compare1_radio_txen;
+	dppi_radio_connect();
 #else
 	nrfx_ppi_channel_alloc(&ppi_ch_radio_ready_timer_start);
 	nrfx_ppi_channel_alloc(&ppi_ch_radio_address_timer_stop);
@@ -587,86 +1258,767 @@ static void ppi_init(void)
 							(1 << ppi_ch_timer_compare0_radio_disable) | (1 << ppi_ch_timer_compare1_radio_txen);
 }
 
+#if ESB_TRACE
+static inline void trace(enum esb_trace_type type, uint8_t pipe, uint8_t pid,
+			 uint8_t attempt, const uint8_t *hdr, uint8_t flags)
+{
+	uint32_t index = (uint32_t)atomic_inc(&trace_head);
+	struct esb_trace_record *rec =
+		&trace_buffer[index & (ESB_TRACE_BUFFER_SIZE - 1)];
+
+	/* The DWT cycle counter stops in WFI, the system clock keeps running. */
+	rec->time = k_cycle_get_32();
+	rec->type = type;
+	rec->state = esb_state;
+	rec->pipe = pipe;
+	rec->pid = pid;
+	rec->attempt = attempt;
+	rec->rssi = (type == ESB_TRACE_RX || type == ESB_TRACE_ACK_RX) ?
+		    (int8_t)NRF_RADIO->RSSISAMPLE : 0;
+	rec->hdr[0] = hdr ? hdr[0] : 0;
+	rec->hdr[1] = hdr ? hdr[1] : 0;
+	rec->flags = flags;
+	rec->reserved = 0;
+	__DMB();
+	rec->seq = (uint16_t)index;
+}
+
+#define TRACE(...) trace(__VA_ARGS__)
+#else
+#define TRACE(...) do {} while (0)
+#endif
+
+static inline bool burst_enabled(void)
+{
+	return (esb_cfg.burst_length > 1) &&
+	       (ESB_PROTOCOL() == ESB_PROTOCOL_ESB_DPL);
+}
+
+static inline bool fec_enabled(void)
+{
+	return (esb_cfg.fec_group > 1) &&
+	       (ESB_PROTOCOL() == ESB_PROTOCOL_ESB_DPL);
+}
+
+static void fec_state_reset(struct fec_state *f)
+{
+	f->received = 0;
+	f->max_len = 0;
+	memset(f->parity, 0, sizeof(f->parity));
+}
+
+static void fec_xor(struct fec_state *f, uint8_t length, const uint8_t *data)
+{
+	f->parity[0] ^= length;
+	for (uint8_t i = 0; i < length; i++) {
+		f->parity[i + 1] ^= data[i];
+	}
+}
+
+/* Start a new group on a pipe whose group was partly queued and then dropped
+ * from the TX FIFO, so that no parity covers frames that were never sent.
+ */
+static void fec_tx_restart(uint8_t pipe)
+{
+	struct fec_state *f = &fec[pipe];
+
+	if (f->index) {
+		f->group = (f->group + 1) & 0x0F;
+		f->index = 0;
+		fec_state_reset(f);
+	}
+}
+
+/* Handle a received FEC frame. Data frames are delivered and added to the
+ * parity of the group, the parity frame rebuilds the frame that is missing
+ * if it is the only one.
+ */
+static bool fec_rx(uint8_t pipe, uint8_t pid)
+{
+	struct fec_state *f = &fec[pipe];
+	uint8_t length = rx_payload_buffer[0];
+	uint8_t hdr = rx_payload_buffer[2];
+	uint8_t index = FEC_HDR_INDEX(hdr);
+	uint16_t missing;
+
+	if (length == 0) {
+		stats[pipe].rx_length_errors++;
+		return false;
+	}
+
+	/* Frames of a group arrive in order, a data frame below the highest one
+	 * received starts a new group with the same number, e.g. after the PTX
+	 * restarted. A repeated index is a duplicate and dropped below.
+	 */
+	if (FEC_HDR_GROUP(hdr) != f->group ||
+	    (index != FEC_INDEX_PARITY &&
+	     (f->received & ~BIT_MASK(index + 1)))) {
+		f->group = FEC_HDR_GROUP(hdr);
+		fec_state_reset(f);
+	}
+
+	if (index != FEC_INDEX_PARITY) {
+		if (index >= esb_cfg.fec_group || (f->received & BIT(index))) {
+			return false;
+		}
+		f->received |= BIT(index);
+		fec_xor(f, length - 1, &rx_payload_buffer[3]);
+
+		return rx_fifo_push_rfbuf(rx_payload_buffer, pipe, pid, 1);
+	}
+
+	missing = BIT_MASK(esb_cfg.fec_group) & ~f->received;
+	if (missing == 0 || (missing & (missing - 1))) {
+		return false;
+	}
+
+	for (uint8_t i = 0; i < MIN(length - 1, sizeof(f->parity)); i++) {
+		f->parity[i] ^= rx_payload_buffer[3 + i];
+	}
+	f->received |= missing;
+
+	if (f->parity[0] == 0 || f->parity[0] > FEC_DATA_MAX) {
+		return false;
+	}
+
+	fec_rx_buffer[0] = f->parity[0] + 1;
+	fec_rx_buffer[1] = rx_payload_buffer[1];
+	fec_rx_buffer[2] = FEC_HDR(f->group, find_lsb_set(missing) - 1);
+	memcpy(&fec_rx_buffer[3], &f->parity[1], f->parity[0]);
+
+	if (!rx_fifo_push_rfbuf(fec_rx_buffer, pipe, pid, 1)) {
+		return false;
+	}
+	stats[pipe].fec_recovered++;
+
+	return true;
+}
+
+/* Write a payload into a TX buffer in radio format. */
+static void tx_buffer_fill(uint8_t *buffer, const struct esb_payload *payload)
+{
+	switch (ESB_PROTOCOL()) {
+	case ESB_PROTOCOL_ESB:
+		buffer[0] = payload->pid;
+		buffer[1] = 0;
+		break;
+
+	case ESB_PROTOCOL_ESB_DPL:
+		buffer[0] = payload->length;
+		buffer[1] = payload->pid << 1;
+		buffer[1] |= payload->noack ? 0x00 : 0x01;
+		break;
+
+	default:
+		/* Should not be reached */
+		break;
+	}
+
+	memcpy(&buffer[2], payload->data, payload->length);
+}
+
+/* Copy the TX FIFO entry after the current one into the idle TX buffer. */
+static void tx_stage_next(void)
+{
+	if (burst_enabled()) {
+		return;
+	}
+
+	uint32_t next;
+
+	if (tx_fifo.count < 2) {
+		return;
+	}
+
+	next = tx_fifo.front + 1;
+	if (next >= CONFIG_ESB_TX_FIFO_SIZE) {
+		next = 0;
+	}
+
+	if (tx_staged == next) {
+		return;
+	}
+
+	/* The radio ISR must not use the buffer while it is being written. */
+	tx_staged = TX_STAGED_NONE;
+	tx_buffer_fill(tx_payload_buffers[tx_buffer_idx ^ 1],
+		       tx_fifo.payload[next]);
+	tx_staged = next;
+}
+
+#if ESB_HW_RETRANSMIT_SUPPORTED
+static void hw_retransmit_init(void)
+{
+	if (!ppi_hw_retransmit_allocated) {
+		nrfx_ppi_channel_alloc(&ppi_ch_radio_disabled_radio_rxen);
+		nrfx_ppi_channel_alloc(&ppi_ch_radio_disabled_group_rx_disable);
+		nrfx_ppi_channel_alloc(&ppi_ch_timer_compare1_group_rx_enable);
+		nrfx_ppi_channel_alloc(&ppi_ch_counter_compare0_group_txen_disable);
+		nrfx_ppi_group_alloc(&ppi_group_rx);
+		nrfx_ppi_group_alloc(&ppi_group_txen);
+		ppi_hw_retransmit_allocated = true;
+	}
+
+	ESB_HW_RETRANSMIT_TIMER->MODE = TIMER_MODE_MODE_LowPowerCounter;
+	ESB_HW_RETRANSMIT_TIMER->BITMODE = TIMER_BITMODE_BITMODE_16Bit;
+	ESB_HW_RETRANSMIT_TIMER->INTENSET = TIMER_INTENSET_COMPARE1_Msk;
+
+	nrfx_ppi_channel_assign(ppi_ch_radio_disabled_radio_rxen,
+		(uint32_t)&NRF_RADIO->EVENTS_DISABLED, (uint32_t)&NRF_RADIO->TASKS_RXEN);
+	nrfx_ppi_channel_fork_assign(ppi_ch_radio_disabled_radio_rxen,
+		(uint32_t)&ESB_SYS_TIMER->TASKS_START);
+	nrfx_ppi_channel_assign(ppi_ch_radio_disabled_group_rx_disable,
+		(uint32_t)&NRF_RADIO->EVENTS_DISABLED,
+		nrfx_ppi_task_addr_group_disable_get(ppi_group_rx));
+	nrfx_ppi_channel_assign(ppi_ch_timer_compare1_group_rx_enable,
+		(uint32_t)&ESB_SYS_TIMER->EVENTS_COMPARE[1],
+		nrfx_ppi_task_addr_group_enable_get(ppi_group_rx));
+	nrfx_ppi_channel_fork_assign(ppi_ch_timer_compare1_group_rx_enable,
+		(uint32_t)&ESB_HW_RETRANSMIT_TIMER->TASKS_COUNT);
+	nrfx_ppi_channel_assign(ppi_ch_counter_compare0_group_txen_disable,
+		(uint32_t)&ESB_HW_RETRANSMIT_TIMER->EVENTS_COMPARE[0],
+		nrfx_ppi_task_addr_group_disable_get(ppi_group_txen));
+
+	nrfx_ppi_channels_include_in_group(
+		(1 << ppi_ch_radio_disabled_radio_rxen) |
+		(1 << ppi_ch_radio_disabled_group_rx_disable), ppi_group_rx);
+	nrfx_ppi_channels_include_in_group(
+		(1 << ppi_ch_timer_compare1_radio_txen), ppi_group_txen);
+
+	ppi_hw_retransmit_mask = (1 << ppi_ch_timer_compare1_group_rx_enable) |
+				 (1 << ppi_ch_counter_compare0_group_txen_disable);
+}
+
+/* Start a TX with ACK where the retransmits are sequenced by PPI:
+ * TX -> RX -> CC[0] time-out -> CC[1] TXEN, up to retransmit_count times.
+ * The CPU is only interrupted by CRCOK/CRCERROR in the RX window and by the
+ * counter when all retransmits have failed.
+ */
+static void hw_retransmit_start(void)
+{
+	NRF_RADIO->SHORTS = radio_shorts_common;
+	NRF_RADIO->INTENCLR = RADIO_INTENCLR_DISABLED_Msk |
+			      RADIO_INTENCLR_READY_Msk;
+	NRF_RADIO->EVENTS_CRCOK = 0;
+	NRF_RADIO->EVENTS_CRCERROR = 0;
+	NRF_RADIO->INTENSET = RADIO_INTENSET_CRCOK_Msk |
+			      RADIO_INTENSET_CRCERROR_Msk;
+
+	/* Same timing as on_radio_disabled_tx, but the timer is started by
+	 * the TX DISABLED event instead of the RX READY event.
+	 */
+	ESB_SYS_TIMER->CC[0] = wait_for_ack_timeout_us + ramp_up_time_us;
+	ESB_SYS_TIMER->CC[1] = esb_cfg.retransmit_delay;
+	ESB_SYS_TIMER->TASKS_CLEAR = 1;
+	ESB_SYS_TIMER->EVENTS_COMPARE[0] = 0;
+	ESB_SYS_TIMER->EVENTS_COMPARE[1] = 0;
+
+	ESB_HW_RETRANSMIT_TIMER->TASKS_CLEAR = 1;
+	ESB_HW_RETRANSMIT_TIMER->CC[0] = esb_cfg.retransmit_count;
+	ESB_HW_RETRANSMIT_TIMER->CC[1] = esb_cfg.retransmit_count + 1;
+	ESB_HW_RETRANSMIT_TIMER->EVENTS_COMPARE[0] = 0;
+	ESB_HW_RETRANSMIT_TIMER->EVENTS_COMPARE[1] = 0;
+	ESB_HW_RETRANSMIT_TIMER->TASKS_START = 1;
+
+	nrfx_ppi_group_enable(ppi_group_rx);
+	nrfx_ppi_group_enable(ppi_group_txen);
+	nrfx_gppi_channels_enable(ppi_hw_retransmit_mask |
+				  (1 << ppi_ch_radio_address_timer_stop) |
+				  (1 << ppi_ch_timer_compare0_radio_disable));
+
+	retransmits_remaining = esb_cfg.retransmit_count;
+	on_radio_disabled = NULL;
+	esb_state = ESB_STATE_PTX_TX_ACK;
+}
+
+static void hw_retransmit_stop(void)
+{
+	if (!hw_retransmit) {
+		return;
+	}
+
+	nrfx_ppi_group_disable(ppi_group_rx);
+	nrfx_ppi_group_disable(ppi_group_txen);
+	nrfx_gppi_channels_disable(ppi_hw_retransmit_mask);
+	ESB_HW_RETRANSMIT_TIMER->TASKS_STOP = 1;
+	NRF_RADIO->INTENCLR = RADIO_INTENCLR_CRCOK_Msk |
+			      RADIO_INTENCLR_CRCERROR_Msk;
+}
+
+/* Number of retransmits the PPI loop has started so far. */
+static uint32_t hw_retransmit_count(void)
+{
+	ESB_HW_RETRANSMIT_TIMER->TASKS_CAPTURE[2] = 1;
+	return ESB_HW_RETRANSMIT_TIMER->CC[2];
+}
+
+static void on_radio_crc_hw_retransmit(void)
+{
+	uint32_t retransmits = hw_retransmit_count();
+
+	/* The ACK is received into the TX buffer because PACKETPTR can't be
+	 * changed by PPI. The radio is disabled by the END -> DISABLE short and
+	 * the ACK timer was stopped by the ADDRESS event.
+	 */
+	if (NRF_RADIO->EVENTS_CRCOK) {
+		NRF_RADIO->EVENTS_CRCOK = 0;
+		nrfx_gppi_channels_disable(ppi_all_channels_mask);
+		hw_retransmit_stop();
+
+		retransmits_remaining = esb_cfg.retransmit_count - retransmits;
+		on_tx_ack_received(tx_payload_buffer);
+		return;
+	}
+
+	/* Something was received but it was corrupted: restore the packet and
+	 * let CC[1] trigger the next retransmit, unless they are all used up.
+	 */
+	NRF_RADIO->EVENTS_CRCERROR = 0;
+	stats[current_payload->pipe].crc_errors++;
+	tx_buffer_fill(tx_payload_buffer, current_payload);
+	ESB_SYS_TIMER->TASKS_CLEAR = 1;
+	ESB_SYS_TIMER->TASKS_START = 1;
+}
+
+static void ESB_HW_RETRANSMIT_TIMER_IRQHandler(void)
+{
+	/* All retransmits are expended and the last ACK window has passed. */
+	ESB_HW_RETRANSMIT_TIMER->EVENTS_COMPARE[1] = 0;
+	nrfx_gppi_channels_disable(ppi_all_channels_mask);
+	hw_retransmit_stop();
+	ESB_SYS_TIMER->TASKS_SHUTDOWN = 1;
+
+	last_tx_attempts = esb_cfg.retransmit_count + 1;
+	interrupt_flags |= INT_TX_FAILED_MSK;
+	stats[current_payload->pipe].tx_failed++;
+	rate_tx_done(current_payload->pipe, last_tx_attempts, false);
+	tx_power_tx_done(current_payload->pipe, false);
+	TRACE(ESB_TRACE_TX_FAILED, current_payload->pipe, current_payload->pid,
+	      last_tx_attempts, NULL, 0);
+
+	esb_state = ESB_STATE_IDLE;
+	NVIC_SetPendingIRQ(ESB_EVT_IRQ);
+}
+#else
+static void hw_retransmit_start(void)
+{
+}
+
+static void hw_retransmit_stop(void)
+{
+}
+#endif
+
+static uint8_t *ack_frame_find(uint32_t pipe, const struct payload_wrap *wrap)
+{
+	for (size_t i = 0; i < 2; i++) {
+		if (ack_frame_wrap[pipe][i] == wrap) {
+			return ack_frames[pipe][i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Build the ACK frame for wrap in the frame of the pipe not holding keep. */
+static uint8_t *ack_frame_fill(uint32_t pipe, struct payload_wrap *wrap,
+			       const struct payload_wrap *keep)
+{
+	uint32_t i = (ack_frame_wrap[pipe][0] == keep) ? 1 : 0;
+
+	tx_buffer_fill(ack_frames[pipe][i], wrap->p_payload);
+	ack_frame_wrap[pipe][i] = wrap;
+
+	return ack_frames[pipe][i];
+}
+
+/* Make sure the first two ACK payloads of the pipe have their frames built. */
+static void ack_frames_stage(uint32_t pipe)
+{
+	struct payload_wrap *head = ack_pl_wrap_pipe[pipe];
+	struct payload_wrap *next;
+
+	if (head == 0) {
+		return;
+	}
+
+	next = head->p_next;
+
+	if (!ack_frame_find(pipe, head)) {
+		ack_frame_fill(pipe, head, next);
+	}
+
+	if (next != 0 && !ack_frame_find(pipe, next)) {
+		ack_frame_fill(pipe, next, head);
+	}
+}
+
+/* Forget the frame of an ACK payload that has been delivered. */
+static void ack_frame_release(uint32_t pipe, const struct payload_wrap *wrap)
+{
+	for (size_t i = 0; i < 2; i++) {
+		if (ack_frame_wrap[pipe][i] == wrap) {
+			ack_frame_wrap[pipe][i] = NULL;
+		}
+	}
+}
+
+static void start_tx_radio(void)
+{
+	NRF_RADIO->TXADDRESS = current_payload->pipe;
+	NRF_RADIO->RXADDRESSES = 1 << current_payload->pipe;
+	NRF_RADIO->FREQUENCY = esb_addr.rf_channel;
+
+	NRF_RADIO->PACKETPTR = (uint32_t)tx_payload_buffer;
+
+	NVIC_ClearPendingIRQ(RADIO_IRQn);
+	irq_enable(RADIO_IRQn);
+
+	NRF_RADIO->EVENTS_ADDRESS = 0;
+	NRF_RADIO->EVENTS_PAYLOAD = 0;
+	NRF_RADIO->EVENTS_DISABLED = 0;
+
+	NRF_RADIO->TASKS_TXEN = 1;
+}
+
+static void burst_start(void);
+static void start_tx_transaction(void);
+
+/* The RSSI of the channel was sampled and the radio disabled by PPI. Send the
+ * packet or back off. TXEN is only triggered once the packet is set up, which
+ * leaves no setup to race the TX ramp-up.
+ */
+static void on_radio_disabled_lbt(void)
+{
+	uint8_t pipe;
+
+	lbt_ppi_disable();
+	on_radio_disabled = NULL;
+
+	if (tx_fifo.count == 0) {
+		/* Flushed during the assessment. */
+		esb_state = ESB_STATE_IDLE;
+		return;
+	}
+
+	pipe = tx_fifo.payload[tx_fifo.front]->pipe;
+
+	if (NRF_RADIO->RSSISAMPLE > esb_cfg.lbt_threshold) {
+		lbt_backoffs = 0;
+		lbt_clear = true;
+		start_tx_transaction();
+		return;
+	}
+
+	stats[pipe].lbt_busy++;
+	lbt_backoff(pipe);
+}
+
+/* Sample the channel before a transmission, without waiting for it. This
+ * costs one RX ramp-up, see on_radio_disabled_lbt.
+ */
+static void lbt_start(void)
+{
+	NRF_RADIO->SHORTS = 0;
+	NRF_RADIO->FREQUENCY = esb_addr.rf_channel;
+
+	NVIC_ClearPendingIRQ(RADIO_IRQn);
+	irq_enable(RADIO_IRQn);
+
+	NRF_RADIO->EVENTS_READY = 0;
+	NRF_RADIO->EVENTS_RSSIEND = 0;
+	NRF_RADIO->EVENTS_DISABLED = 0;
+	NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
+
+	lbt_ppi_enable();
+
+	on_radio_disabled = on_radio_disabled_lbt;
+	esb_state = ESB_STATE_PTX_LBT;
+
+	NRF_RADIO->TASKS_RXEN = 1;
+}
+
 static void start_tx_transaction(void)
 {
 	bool ack;
 
+	/* The rate and power were already set before the assessment. */
+	if (!lbt_clear) {
+		rate_tx_start(tx_fifo.payload[tx_fifo.front]->pipe);
+		tx_power_tx_start(tx_fifo.payload[tx_fifo.front]->pipe);
+
+		if (esb_cfg.lbt_threshold) {
+			lbt_start();
+			return;
+		}
+	}
+	lbt_clear = false;
+
+	if (burst_enabled()) {
+		burst_start();
+		return;
+	}
+
 	last_tx_attempts = 1;
 	/* Prepare the payload */
 	current_payload = tx_fifo.payload[tx_fifo.front];
 
-	switch (esb_cfg.protocol) {
+	if (tx_staged == tx_fifo.front) {
+		/* Already copied while the previous packet was on air. */
+		tx_buffer_idx ^= 1;
+		tx_staged = TX_STAGED_NONE;
+	} else {
+		tx_buffer_fill(tx_payload_buffers[tx_buffer_idx],
+			       current_payload);
+	}
+	tx_payload_buffer = tx_payload_buffers[tx_buffer_idx];
+
+	switch (ESB_PROTOCOL()) {
 	case ESB_PROTOCOL_ESB:
 		update_rf_payload_format(current_payload->length);
-		tx_payload_buffer[0] = current_payload->pid;
-		tx_payload_buffer[1] = 0;
-		memcpy(&tx_payload_buffer[2], current_payload->data,
-		       current_payload->length);
 
 		NRF_RADIO->SHORTS = radio_shorts_common |
 				    RADIO_SHORTS_DISABLED_RXEN_Msk;
 		NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk |
 				      RADIO_INTENSET_READY_Msk;
 
-		/* Configure the retransmit counter */
-		retransmits_remaining = esb_cfg.retransmit_count;
-		on_radio_disabled = on_radio_disabled_tx;
-		esb_state = ESB_STATE_PTX_TX_ACK;
-		break;
+		/* Configure the retransmit counter */
+		retransmits_remaining = esb_cfg.retransmit_count;
+		on_radio_disabled = on_radio_disabled_tx;
+		esb_state = ESB_STATE_PTX_TX_ACK;
+		break;
+
+	case ESB_PROTOCOL_ESB_DPL:
+		ack = !current_payload->noack || !esb_cfg.selective_auto_ack;
+
+		/* Handling ack if noack is set to false or if
+		 * selective auto ack is turned off
+		 */
+		if (ack && hw_retransmit) {
+			hw_retransmit_start();
+		} else if (ack) {
+			NRF_RADIO->SHORTS = radio_shorts_common |
+					    RADIO_SHORTS_DISABLED_RXEN_Msk;
+			NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk |
+					      RADIO_INTENSET_READY_Msk;
+
+			/* Configure the retransmit counter */
+			retransmits_remaining = esb_cfg.retransmit_count;
+			on_radio_disabled = on_radio_disabled_tx;
+			esb_state = ESB_STATE_PTX_TX_ACK;
+		} else {
+			NRF_RADIO->SHORTS = radio_shorts_common;
+			NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
+			on_radio_disabled = on_radio_disabled_tx_noack;
+			esb_state = ESB_STATE_PTX_TX;
+		}
+		break;
+
+	default:
+		/* Should not be reached */
+		break;
+	}
+
+	start_tx_radio();
+
+	/* Use the ramp-up and airtime to prepare the next packet. */
+	tx_stage_next();
+}
+
+/* Send the burst frame with the given index. The last pending frame requests
+ * the ACK and goes through the normal ACK wait, the others are followed
+ * directly by the next one.
+ */
+static void burst_send(uint8_t index)
+{
+	bool last = (burst_pending >> (index + 1)) == 0;
+	uint32_t slot = (tx_fifo.front + index) % CONFIG_ESB_TX_FIFO_SIZE;
+
+	current_payload = tx_fifo.payload[slot];
+	burst_index = index;
+
+	tx_payload_buffer[0] = current_payload->length + 1;
+	tx_payload_buffer[1] = (current_payload->pid << 1) | (last ? 0x01 : 0x00);
+	tx_payload_buffer[2] = BURST_HDR(burst_id, index);
+	memcpy(&tx_payload_buffer[3], current_payload->data,
+	       current_payload->length);
+
+	if (last) {
+		NRF_RADIO->SHORTS = radio_shorts_common |
+				    RADIO_SHORTS_DISABLED_RXEN_Msk;
+		NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk |
+				      RADIO_INTENSET_READY_Msk;
+		on_radio_disabled = on_radio_disabled_tx;
+		esb_state = ESB_STATE_PTX_TX_ACK;
+	} else {
+		NRF_RADIO->SHORTS = radio_shorts_common;
+		NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
+		on_radio_disabled = on_radio_disabled_tx_burst;
+		esb_state = ESB_STATE_PTX_TX;
+	}
+
+	start_tx_radio();
+}
+
+/* Send all pending frames of the burst. */
+static void burst_send_pending(void)
+{
+	burst_send(find_lsb_set(burst_pending) - 1);
+}
+
+/* Start a burst with the queued packets of the pipe at the FIFO front. */
+static void burst_start(void)
+{
+	uint8_t pipe = tx_fifo.payload[tx_fifo.front]->pipe;
+	uint32_t slot = tx_fifo.front;
+
+	burst_count = 0;
+	while (burst_count < MIN(esb_cfg.burst_length, tx_fifo.count) &&
+	       tx_fifo.payload[slot]->pipe == pipe) {
+		burst_count++;
+		slot = (slot + 1) % CONFIG_ESB_TX_FIFO_SIZE;
+	}
+
+	burst_id = (burst_id + 1) & 0x0F;
+	burst_pending = BIT_MASK(burst_count);
+	retransmits_remaining = esb_cfg.retransmit_count;
+	last_tx_attempts = 1;
+	tx_payload_buffer = tx_payload_buffers[tx_buffer_idx];
+
+	burst_send_pending();
+}
+
+static void on_radio_disabled_tx_burst(void)
+{
+	TRACE(ESB_TRACE_TX, current_payload->pipe, current_payload->pid,
+	      last_tx_attempts, tx_payload_buffer, 0);
+
+	burst_send(find_lsb_set(burst_pending & ~BIT_MASK(burst_index + 1)) - 1);
+}
+
+/* Remove the acknowledged frames of the burst from the TX FIFO and report
+ * them. The frames that ran out of retransmits move up to the FIFO front in
+ * their order and stay queued, and TX is suspended as for a failed packet
+ * outside a burst.
+ */
+static void burst_done(bool success)
+{
+	struct esb_payload *acked[ESB_BURST_LENGTH_MAX];
+	struct esb_payload *failed[ESB_BURST_LENGTH_MAX];
+	uint8_t pipe = tx_fifo.payload[tx_fifo.front]->pipe;
+	uint8_t acked_count = 0;
+	uint8_t failed_count = 0;
+	uint32_t slot = tx_fifo.front;
+
+	rate_tx_done(pipe, last_tx_attempts, success);
+	tx_power_tx_done(pipe, success);
+
+	for (uint8_t i = 0; i < burst_count; i++) {
+		struct esb_payload *payload = tx_fifo.payload[slot];
+
+		if (burst_pending & BIT(i)) {
+			stats[pipe].tx_failed++;
+			interrupt_flags |= INT_TX_FAILED_MSK;
+			failed[failed_count++] = payload;
+		} else {
+			stats_tx_done(pipe, last_tx_attempts);
+			interrupt_flags |= INT_TX_SUCCESS_MSK;
+			acked[acked_count++] = payload;
+		}
+		slot = (slot + 1) % CONFIG_ESB_TX_FIFO_SIZE;
+	}
+
+	if (failed_count > 0) {
+		/* Move the acknowledged frames in front of the failed ones to
+		 * remove them. The staged buffer no longer matches its slot.
+		 */
+		slot = tx_fifo.front;
+		for (uint8_t i = 0; i < burst_count; i++) {
+			tx_fifo.payload[slot] = (i < acked_count) ?
+				acked[i] : failed[i - acked_count];
+			slot = (slot + 1) % CONFIG_ESB_TX_FIFO_SIZE;
+		}
+		tx_staged = TX_STAGED_NONE;
+	}
+
+	for (uint8_t i = 0; i < acked_count; i++) {
+		tx_fifo_remove_last();
+	}
+
+	burst_count = 0;
+
+	if ((tx_fifo.count == 0) || (failed_count > 0) ||
+	    (esb_cfg.tx_mode == ESB_TXMODE_MANUAL)) {
+		esb_state = ESB_STATE_IDLE;
+		NVIC_SetPendingIRQ(ESB_EVT_IRQ);
+	} else {
+		NVIC_SetPendingIRQ(ESB_EVT_IRQ);
+		start_tx_transaction();
+	}
+}
+
+/* The burst ACK was received or missed, resend what is still missing. */
+static void burst_ack(const uint8_t *ack_buffer)
+{
+	if (ack_buffer && ack_buffer[0] >= 2) {
+		burst_pending &= ~(ack_buffer[2] | (ack_buffer[3] << 8));
+	}
+
+	if (burst_pending == 0) {
+		burst_done(true);
+	} else if (retransmits_remaining-- == 0) {
+		last_tx_attempts = esb_cfg.retransmit_count + 1;
+		TRACE(ESB_TRACE_TX_FAILED, current_payload->pipe,
+		      current_payload->pid, last_tx_attempts, NULL, 0);
+		burst_done(false);
+	} else {
+		last_tx_attempts++;
+		burst_send_pending();
+	}
+}
 
-	case ESB_PROTOCOL_ESB_DPL:
-		ack = !current_payload->noack || !esb_cfg.selective_auto_ack;
-		tx_payload_buffer[0] = current_payload->length;
-		tx_payload_buffer[1] = current_payload->pid << 1;
-		tx_payload_buffer[1] |= current_payload->noack ? 0x00 : 0x01;
-		memcpy(&tx_payload_buffer[2], current_payload->data,
-		       current_payload->length);
+/* Build the bitmap ACK of a burst frame received on the pipe. */
+static uint8_t *burst_ack_frame_get(const struct pipe_info *pipe_info)
+{
+	burst_ack_frame[0] = 2;
+	burst_ack_frame[1] = rx_payload_buffer[1];
+	burst_ack_frame[2] = pipe_info->burst_rx & 0xFF;
+	burst_ack_frame[3] = pipe_info->burst_rx >> 8;
 
-		/* Handling ack if noack is set to false or if
-		 * selective auto ack is turned off
-		 */
-		if (ack) {
-			NRF_RADIO->SHORTS = radio_shorts_common |
-					    RADIO_SHORTS_DISABLED_RXEN_Msk;
-			NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk |
-					      RADIO_INTENSET_READY_Msk;
+	return burst_ack_frame;
+}
 
-			/* Configure the retransmit counter */
-			retransmits_remaining = esb_cfg.retransmit_count;
-			on_radio_disabled = on_radio_disabled_tx;
-			esb_state = ESB_STATE_PTX_TX_ACK;
-		} else {
-			NRF_RADIO->SHORTS = radio_shorts_common;
-			NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
-			on_radio_disabled = on_radio_disabled_tx_noack;
-			esb_state = ESB_STATE_PTX_TX;
-		}
-		break;
+/* Track a received burst frame, returns false for a duplicate. */
+static bool burst_rx(struct pipe_info *pipe_info)
+{
+	uint8_t hdr = rx_payload_buffer[2];
+	uint16_t bit = BIT(BURST_HDR_INDEX(hdr));
 
-	default:
-		/* Should not be reached */
-		break;
+	if (rx_payload_buffer[0] == 0) {
+		return false;
 	}
 
-	NRF_RADIO->TXADDRESS = current_payload->pipe;
-	NRF_RADIO->RXADDRESSES = 1 << current_payload->pipe;
-	NRF_RADIO->FREQUENCY = esb_addr.rf_channel;
-
-	NRF_RADIO->PACKETPTR = (uint32_t)tx_payload_buffer;
+	if (BURST_HDR_ID(hdr) != pipe_info->burst_id) {
+		pipe_info->burst_id = BURST_HDR_ID(hdr);
+		pipe_info->burst_rx = 0;
+	}
 
-	NVIC_ClearPendingIRQ(RADIO_IRQn);
-	irq_enable(RADIO_IRQn);
+	if (pipe_info->burst_rx & bit) {
+		return false;
+	}
 
-	NRF_RADIO->EVENTS_ADDRESS = 0;
-	NRF_RADIO->EVENTS_PAYLOAD = 0;
-	NRF_RADIO->EVENTS_DISABLED = 0;
+	pipe_info->burst_rx |= bit;
 
-	NRF_RADIO->TASKS_TXEN = 1;
+	return true;
 }
 
 static void on_radio_disabled_tx_noack(void)
 {
+	TRACE(ESB_TRACE_TX, current_payload->pipe, current_payload->pid, 1,
+	      tx_payload_buffer, 0);
+	last_tx_timestamp = timestamp_address();
 	interrupt_flags |= INT_TX_SUCCESS_MSK;
+	stats_tx_done(current_payload->pipe, 1);
 	tx_fifo_remove_last();
 
 	if (tx_fifo.count == 0) {
@@ -680,6 +2032,11 @@ static void on_radio_disabled_tx_noack(void)
 
 static void on_radio_disabled_tx(void)
 {
+	TRACE(ESB_TRACE_TX, current_payload->pipe, current_payload->pid,
+	      esb_cfg.retransmit_count - retransmits_remaining + 1,
+	      tx_payload_buffer, 0);
+	last_tx_timestamp = timestamp_address();
+
 	/* Remove the DISABLED -> RXEN shortcut, to make sure the radio stays
 	 * disabled after the RX window
 	 */
@@ -690,7 +2047,7 @@ static void on_radio_disabled_tx(void)
 	 * received by the time defined in wait_for_ack_timeout_us
 	 */
 	ESB_SYS_TIMER->CC[0] = wait_for_ack_timeout_us;
-	ESB_SYS_TIMER->CC[1] = esb_cfg.retransmit_delay - 130;
+	ESB_SYS_TIMER->CC[1] = esb_cfg.retransmit_delay - ramp_up_time_us;
 	ESB_SYS_TIMER->TASKS_CLEAR = 1;
 	ESB_SYS_TIMER->EVENTS_COMPARE[0] = 0;
 	ESB_SYS_TIMER->EVENTS_COMPARE[1] = 0;
@@ -703,7 +2060,7 @@ static void on_radio_disabled_tx(void)
 
 	NRF_RADIO->EVENTS_END = 0;
 
-	if (esb_cfg.protocol == ESB_PROTOCOL_ESB) {
+	if (ESB_PROTOCOL() == ESB_PROTOCOL_ESB) {
 		update_rf_payload_format(0);
 	}
 
@@ -712,6 +2069,49 @@ static void on_radio_disabled_tx(void)
 	esb_state = ESB_STATE_PTX_RX_ACK;
 }
 
+/* Complete a TX transaction with a valid ACK received into ack_buffer. */
+static void on_tx_ack_received(const uint8_t *ack_buffer)
+{
+	ESB_SYS_TIMER->TASKS_SHUTDOWN = 1;
+
+	last_ack_timestamp = timestamp_address();
+
+	if (burst_enabled()) {
+		burst_ack(ack_buffer);
+		return;
+	}
+
+	interrupt_flags |= INT_TX_SUCCESS_MSK;
+	last_tx_attempts = esb_cfg.retransmit_count -
+			   retransmits_remaining + 1;
+	stats_tx_done(current_payload->pipe, last_tx_attempts);
+	rate_tx_done(current_payload->pipe, last_tx_attempts, true);
+	tx_power_tx_done(current_payload->pipe, true);
+	TRACE(ESB_TRACE_ACK_RX, current_payload->pipe, current_payload->pid,
+	      last_tx_attempts, ack_buffer, ESB_TRACE_FLAG_CRC_OK);
+
+	tx_fifo_remove_last();
+
+	if (ESB_PROTOCOL() != ESB_PROTOCOL_ESB &&
+	    ack_buffer[0] > 0) {
+		if (rx_fifo_push_rfbuf(ack_buffer,
+				       (uint8_t)NRF_RADIO->TXADDRESS,
+				       ack_buffer[1] >> 1, 0)) {
+			interrupt_flags |=
+				INT_RX_DATA_RECEIVED_MSK;
+		}
+	}
+
+	if ((tx_fifo.count == 0) ||
+	    (esb_cfg.tx_mode == ESB_TXMODE_MANUAL)) {
+		esb_state = ESB_STATE_IDLE;
+		NVIC_SetPendingIRQ(ESB_EVT_IRQ);
+	} else {
+		NVIC_SetPendingIRQ(ESB_EVT_IRQ);
+		start_tx_transaction();
+	}
+}
+
 static void on_radio_disabled_tx_wait_for_ack(void)
 {
 	/* This marks the completion of a TX_RX sequence (TX with ACK) */
@@ -723,32 +2123,18 @@ static void on_radio_disabled_tx_wait_for_ack(void)
 
 	/* If the radio has received a packet and the CRC status is OK */
 	if (NRF_RADIO->EVENTS_END && NRF_RADIO->CRCSTATUS != 0) {
-		ESB_SYS_TIMER->TASKS_SHUTDOWN = 1;
-
-		interrupt_flags |= INT_TX_SUCCESS_MSK;
-		last_tx_attempts = esb_cfg.retransmit_count -
-				   retransmits_remaining + 1;
-
-		tx_fifo_remove_last();
-
-		if (esb_cfg.protocol != ESB_PROTOCOL_ESB &&
-		    rx_payload_buffer[0] > 0) {
-			if (rx_fifo_push_rfbuf((uint8_t)NRF_RADIO->TXADDRESS,
-					       rx_payload_buffer[1] >> 1)) {
-				interrupt_flags |=
-					INT_RX_DATA_RECEIVED_MSK;
-			}
+		on_tx_ack_received(rx_payload_buffer);
+	} else {
+		if (NRF_RADIO->EVENTS_END) {
+			stats[current_payload->pipe].crc_errors++;
 		}
 
-		if ((tx_fifo.count == 0) ||
-		    (esb_cfg.tx_mode == ESB_TXMODE_MANUAL)) {
-			esb_state = ESB_STATE_IDLE;
-			NVIC_SetPendingIRQ(ESB_EVT_IRQ);
-		} else {
-			NVIC_SetPendingIRQ(ESB_EVT_IRQ);
-			start_tx_transaction();
+		if (burst_enabled()) {
+			ESB_SYS_TIMER->TASKS_SHUTDOWN = 1;
+			burst_ack(NULL);
+			return;
 		}
-	} else {
+
 		if (retransmits_remaining-- == 0) {
 			ESB_SYS_TIMER->TASKS_SHUTDOWN = 1;
 
@@ -757,6 +2143,12 @@ static void on_radio_disabled_tx_wait_for_ack(void)
 			 */
 			last_tx_attempts = esb_cfg.retransmit_count + 1;
 			interrupt_flags |= INT_TX_FAILED_MSK;
+			stats[current_payload->pipe].tx_failed++;
+			rate_tx_done(current_payload->pipe, last_tx_attempts,
+				     false);
+			tx_power_tx_done(current_payload->pipe, false);
+			TRACE(ESB_TRACE_TX_FAILED, current_payload->pipe,
+			      current_payload->pid, last_tx_attempts, NULL, 0);
 
 			esb_state = ESB_STATE_IDLE;
 			NVIC_SetPendingIRQ(ESB_EVT_IRQ);
@@ -780,69 +2172,108 @@ static void on_radio_disabled_tx_wait_for_ack(void)
 	}
 }
 
+/* Abort the ACK that the DISABLED -> TXEN short has started and go back to
+ * RX. The DISABLED -> RXEN short restarts the receiver, so the radio interrupt
+ * does not have to wait for the radio to be disabled.
+ */
 static void clear_events_restart_rx(void)
 {
-	NRF_RADIO->SHORTS = radio_shorts_common;
+	NRF_RADIO->SHORTS = radio_shorts_common |
+			    RADIO_SHORTS_DISABLED_RXEN_Msk;
 	update_rf_payload_format(esb_cfg.payload_length);
 	NRF_RADIO->PACKETPTR = (uint32_t)rx_payload_buffer;
-	NRF_RADIO->EVENTS_DISABLED = 0;
+	on_radio_disabled = on_radio_disabled_rx_restart;
 	NRF_RADIO->TASKS_DISABLE = 1;
+}
 
-	while (NRF_RADIO->EVENTS_DISABLED == 0) {
-		/* wait for register to settle */
-	}
+static void on_radio_disabled_rx_restart(void)
+{
+	/* The receiver is already ramping up. */
+	NRF_RADIO->SHORTS = radio_shorts_common |
+			    RADIO_SHORTS_DISABLED_TXEN_Msk;
+	on_radio_disabled = on_radio_disabled_rx;
+}
+
+/* The receiver was disabled to listen on the next rate. */
+static void on_radio_disabled_rx_rate(void)
+{
+	rate_hunt_idx = (rate_hunt_idx + 1) % ARRAY_SIZE(rate_ladder);
+	(void)radio_bitrate_set(rate_ladder[rate_hunt_idx]);
 
-	NRF_RADIO->EVENTS_DISABLED = 0;
 	NRF_RADIO->SHORTS = radio_shorts_common |
 			    RADIO_SHORTS_DISABLED_TXEN_Msk;
+	on_radio_disabled = on_radio_disabled_rx;
 
+	NRF_RADIO->EVENTS_ADDRESS = 0;
+	NRF_RADIO->EVENTS_PAYLOAD = 0;
 	NRF_RADIO->TASKS_RXEN = 1;
 }
 
-static void on_radio_disabled_rx_dpl(bool retransmit_payload,
-				     struct pipe_info *pipe_info)
+static void on_radio_disabled_rx_stopped(void)
+{
+	if (esb_cfg.rate_adaptation) {
+		sys_timer_alarm_stop();
+	}
+	NRF_RADIO->INTENCLR = 0xFFFFFFFF;
+	on_radio_disabled = NULL;
+	esb_state = ESB_STATE_IDLE;
+	TRACE(ESB_TRACE_STATE, 0, 0, 0, NULL, 0);
+}
+
+/* Return the ACK frame to send on the pipe that has just received a packet.
+ * The frame has normally been built by ack_frames_stage(), so only the PID
+ * byte is written here.
+ */
+static uint8_t *on_radio_disabled_rx_dpl(bool retransmit_payload,
+					 struct pipe_info *pipe_info)
 {
 	uint32_t pipe = NRF_RADIO->RXMATCH;
+	struct payload_wrap *wrap = 0;
+	uint8_t *frame;
 
 	if (tx_fifo.count > 0 && ack_pl_wrap_pipe[pipe] != 0) {
-		current_payload = ack_pl_wrap_pipe[pipe]->p_payload;
+		wrap = ack_pl_wrap_pipe[pipe];
 
 		/* Pipe stays in ACK with payload until TX FIFO is empty */
 		/* Do not report TX success on first ack payload or retransmit */
 		if (pipe_info->ack_payload == true && !retransmit_payload) {
-			ack_pl_wrap_pipe[pipe]->in_use = false;
-			ack_pl_wrap_pipe[pipe] = ack_pl_wrap_pipe[pipe]->p_next;
+			ack_frame_release(pipe, wrap);
+			stats[pipe].ack_payloads_sent++;
+			wrap->in_use = false;
+			ack_pl_wrap_pipe[pipe] = wrap->p_next;
 			tx_fifo.count--;
 			if (tx_fifo.count > 0 && ack_pl_wrap_pipe[pipe] != 0) {
-				current_payload = ack_pl_wrap_pipe[pipe]->p_payload;
+				wrap = ack_pl_wrap_pipe[pipe];
 			} else {
-				current_payload = 0;
+				wrap = 0;
 			}
 
 			/* ACK payloads also require TX_DS */
 			/* (page 40 of the 'nRF24LE1_Product_Specification_rev1_6.pdf') */
 			interrupt_flags |= INT_TX_SUCCESS_MSK;
 		}
+	}
 
-		if (current_payload != 0) {
-			pipe_info->ack_payload = true;
-			update_rf_payload_format(current_payload->length);
-			tx_payload_buffer[0] = current_payload->length;
-			memcpy(&tx_payload_buffer[2],
-					current_payload->data,
-					current_payload->length);
-		} else {
-			pipe_info->ack_payload = false;
-			update_rf_payload_format(0);
-			tx_payload_buffer[0] = 0;
+	/* The DPL packet format does not depend on the payload length, so the
+	 * PCNF registers are left as they are.
+	 */
+	if (wrap != 0) {
+		current_payload = wrap->p_payload;
+		pipe_info->ack_payload = true;
+		frame = ack_frame_find(pipe, wrap);
+		if (!frame) {
+			frame = ack_frame_fill(pipe, wrap, wrap->p_next);
 		}
 	} else {
+		current_payload = 0;
 		pipe_info->ack_payload = false;
-		update_rf_payload_format(0);
-		tx_payload_buffer[0] = 0;
+		frame = ack_empty_frame;
+		frame[0] = 0;
 	}
 
-	tx_payload_buffer[1] = rx_payload_buffer[1];
+	frame[1] = rx_payload_buffer[1];
+
+	return frame;
 }
 
 static void on_radio_disabled_rx(void)
@@ -851,35 +2282,61 @@ static void on_radio_disabled_rx(void)
 	bool send_rx_event = true;
 	struct pipe_info *pipe_info;
 
+	TRACE(ESB_TRACE_RX, NRF_RADIO->RXMATCH, rx_payload_buffer[1] >> 1, 0,
+	      rx_payload_buffer,
+	      NRF_RADIO->CRCSTATUS ? ESB_TRACE_FLAG_CRC_OK : 0);
+
 	if (NRF_RADIO->CRCSTATUS == 0) {
+		stats[NRF_RADIO->RXMATCH].crc_errors++;
 		clear_events_restart_rx();
 		return;
 	}
 
 	if (rx_fifo.count >= CONFIG_ESB_RX_FIFO_SIZE) {
+		stats[NRF_RADIO->RXMATCH].rx_overflows++;
 		clear_events_restart_rx();
 		return;
 	}
 
+	if (esb_cfg.rate_adaptation) {
+		/* Traffic on this rate, stay. */
+		ESB_SYS_TIMER->TASKS_CLEAR = 1;
+	}
+
 	pipe_info = &rx_pipe_info[NRF_RADIO->RXMATCH];
-	if (NRF_RADIO->RXCRC == pipe_info->crc &&
-	    (rx_payload_buffer[1] >> 1) == pipe_info->pid) {
+	if (burst_enabled()) {
+		if (!burst_rx(pipe_info)) {
+			send_rx_event = false;
+			stats[NRF_RADIO->RXMATCH].rx_duplicates++;
+		}
+	} else if (NRF_RADIO->RXCRC == pipe_info->crc &&
+		   (rx_payload_buffer[1] >> 1) == pipe_info->pid) {
 		retransmit_payload = true;
 		send_rx_event = false;
+		stats[NRF_RADIO->RXMATCH].rx_duplicates++;
 	}
 
 	pipe_info->pid = rx_payload_buffer[1] >> 1;
 	pipe_info->crc = NRF_RADIO->RXCRC;
 
-	/* Check if an ack should be sent */
-	if ((esb_cfg.selective_auto_ack == false) ||
+	/* Check if an ack should be sent, in a burst only the last frame sent
+	 * asks for one.
+	 */
+	if ((esb_cfg.selective_auto_ack == false && !burst_enabled()) ||
 	    ((rx_payload_buffer[1] & 0x01) == 1)) {
+		uint8_t *ack_frame = tx_payload_buffer;
+
 		NRF_RADIO->SHORTS = radio_shorts_common |
 				    RADIO_SHORTS_DISABLED_RXEN_Msk;
 
-		switch (esb_cfg.protocol) {
+		switch (ESB_PROTOCOL()) {
 		case ESB_PROTOCOL_ESB_DPL:
-			on_radio_disabled_rx_dpl(retransmit_payload, pipe_info);
+			if (burst_enabled()) {
+				ack_frame = burst_ack_frame_get(pipe_info);
+			} else {
+				ack_frame = on_radio_disabled_rx_dpl(
+					retransmit_payload, pipe_info);
+			}
 			break;
 
 		case ESB_PROTOCOL_ESB:
@@ -892,8 +2349,13 @@ static void on_radio_disabled_rx(void)
 		esb_state = ESB_STATE_PRX_SEND_ACK;
 		NRF_RADIO->TXADDRESS = NRF_RADIO->RXMATCH;
 
-		NRF_RADIO->PACKETPTR = (uint32_t)tx_payload_buffer;
+		NRF_RADIO->PACKETPTR = (uint32_t)ack_frame;
 		on_radio_disabled = on_radio_disabled_rx_ack;
+
+		/* The ACK is now set up, build the frames for the next ones */
+		if (ESB_PROTOCOL() == ESB_PROTOCOL_ESB_DPL && !burst_enabled()) {
+			ack_frames_stage(NRF_RADIO->RXMATCH);
+		}
 	} else {
 		clear_events_restart_rx();
 	}
@@ -903,7 +2365,17 @@ static void on_radio_disabled_rx(void)
 		 * event if the operation was
 		 * successful.
 		 */
-		if (rx_fifo_push_rfbuf(NRF_RADIO->RXMATCH, pipe_info->pid)) {
+		bool pushed;
+
+		if (fec_enabled()) {
+			pushed = fec_rx(NRF_RADIO->RXMATCH, pipe_info->pid);
+		} else {
+			pushed = rx_fifo_push_rfbuf(rx_payload_buffer,
+						    NRF_RADIO->RXMATCH,
+						    pipe_info->pid,
+						    burst_enabled() ? 1 : 0);
+		}
+		if (pushed) {
 			interrupt_flags |= INT_RX_DATA_RECEIVED_MSK;
 			NVIC_SetPendingIRQ(ESB_EVT_IRQ);
 		}
@@ -912,9 +2384,15 @@ static void on_radio_disabled_rx(void)
 
 static void on_radio_disabled_rx_ack(void)
 {
+	TRACE(ESB_TRACE_ACK_TX, NRF_RADIO->TXADDRESS,
+	      ((uint8_t *)NRF_RADIO->PACKETPTR)[1] >> 1, 1,
+	      (uint8_t *)NRF_RADIO->PACKETPTR, 0);
+
 	NRF_RADIO->SHORTS = radio_shorts_common |
 			    RADIO_SHORTS_DISABLED_TXEN_Msk;
-	update_rf_payload_format(esb_cfg.payload_length);
+	if (ESB_PROTOCOL() == ESB_PROTOCOL_ESB) {
+		update_rf_payload_format(esb_cfg.payload_length);
+	}
 
 	NRF_RADIO->PACKETPTR = (uint32_t)rx_payload_buffer;
 	on_radio_disabled = on_radio_disabled_rx;
@@ -938,8 +2416,117 @@ static void get_and_clear_irqs(uint32_t *interrupts)
 	irq_unlock(key);
 }
 
+static inline void radio_isr_timing_init(void)
+{
+#if ESB_ISR_PROFILING
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	radio_isr_wcet = 0;
+#endif
+}
+
+static inline uint32_t radio_isr_timing_start(void)
+{
+#if ESB_ISR_PROFILING
+	return DWT->CYCCNT;
+#else
+	return 0;
+#endif
+}
+
+static inline uint32_t radio_isr_timing_end(uint32_t start)
+{
+#if ESB_ISR_PROFILING
+	uint32_t cycles = DWT->CYCCNT - start;
+
+	if (cycles > radio_isr_wcet) {
+		radio_isr_wcet = cycles;
+	}
+
+	return cycles;
+#else
+	return 0;
+#endif
+}
+
+static inline uint32_t profile_start(void)
+{
+#if ESB_ISR_PROFILING
+	return DWT->CYCCNT;
+#else
+	return 0;
+#endif
+}
+
+static inline void profile_add(enum esb_profile_id id, uint32_t cycles)
+{
+#if ESB_ISR_PROFILING
+	struct profile_data *p = &profile[id];
+	uint32_t bucket = 31 - __CLZ(cycles | 1);
+
+	if (p->count == 0 || cycles < p->min) {
+		p->min = cycles;
+	}
+	if (cycles > p->max) {
+		p->max = cycles;
+	}
+	p->count++;
+	p->total += cycles;
+	p->hist[MIN(bucket, ESB_PROFILE_HIST_BUCKETS - 1)]++;
+#endif
+}
+
+static inline void profile_end(enum esb_profile_id id, uint32_t start)
+{
+#if ESB_ISR_PROFILING
+	profile_add(id, DWT->CYCCNT - start);
+#endif
+}
+
+#if ESB_ISR_PROFILING
+static enum esb_profile_id profile_disabled_id(void (*handler)(void))
+{
+	if (handler == on_radio_disabled_tx_noack) {
+		return ESB_PROFILE_DISABLED_TX_NOACK;
+	} else if (handler == on_radio_disabled_tx) {
+		return ESB_PROFILE_DISABLED_TX;
+	} else if (handler == on_radio_disabled_tx_wait_for_ack) {
+		return ESB_PROFILE_DISABLED_TX_WAIT_FOR_ACK;
+	} else if (handler == on_radio_disabled_rx) {
+		return ESB_PROFILE_DISABLED_RX;
+	} else if (handler == on_radio_disabled_rx_ack) {
+		return ESB_PROFILE_DISABLED_RX_ACK;
+	}
+
+	return ESB_PROFILE_DISABLED_OTHER;
+}
+#endif
+
+static inline void call_on_radio_disabled(void)
+{
+#if ESB_ISR_PROFILING
+	void (*handler)(void) = on_radio_disabled;
+	uint32_t start = profile_start();
+
+	handler();
+	profile_end(profile_disabled_id(handler), start);
+#else
+	on_radio_disabled();
+#endif
+}
+
+static inline void call_event_handler(const struct esb_evt *event)
+{
+	uint32_t start = profile_start();
+
+	event_handler(event);
+	profile_end(ESB_PROFILE_EVENT_HANDLER, start);
+}
+
 void RADIO_IRQHandler(void)
 {
+	uint32_t start = radio_isr_timing_start();
+
 	if (NRF_RADIO->EVENTS_READY &&
 	    (NRF_RADIO->INTENSET & RADIO_INTENSET_READY_Msk)) {
 		NRF_RADIO->EVENTS_READY = 0;
@@ -957,6 +2544,14 @@ void RADIO_IRQHandler(void)
 		}
 	}
 
+#if ESB_HW_RETRANSMIT_SUPPORTED
+	if ((NRF_RADIO->EVENTS_CRCOK || NRF_RADIO->EVENTS_CRCERROR) &&
+	    (NRF_RADIO->INTENSET & (RADIO_INTENSET_CRCOK_Msk |
+				    RADIO_INTENSET_CRCERROR_Msk))) {
+		on_radio_crc_hw_retransmit();
+	}
+#endif
+
 	if (NRF_RADIO->EVENTS_DISABLED &&
 	    (NRF_RADIO->INTENSET & RADIO_INTENSET_DISABLED_Msk)) {
 		NRF_RADIO->EVENTS_DISABLED = 0;
@@ -964,59 +2559,155 @@ void RADIO_IRQHandler(void)
 		 * current protocol state.
 		 */
 		if (on_radio_disabled) {
-			on_radio_disabled();
+			call_on_radio_disabled();
 		}
 	}
+
+	/* One measurement feeds both the WCET and the profile. */
+	profile_add(ESB_PROFILE_RADIO_IRQ, radio_isr_timing_end(start));
 }
 
 static void ESB_EVT_IRQHandler(void)
 {
+	uint32_t start = profile_start();
 	uint32_t interrupts;
 	struct esb_evt event;
 
 	event.tx_attempts = last_tx_attempts;
+	event.tx_timestamp = last_tx_timestamp;
+	event.ack_timestamp = last_ack_timestamp;
 
 	get_and_clear_irqs(&interrupts);
 	if (event_handler != NULL) {
 		if (interrupts & INT_TX_SUCCESS_MSK) {
 			event.evt_id = ESB_EVENT_TX_SUCCESS;
-			event_handler(&event);
+			call_event_handler(&event);
 		}
 		if (interrupts & INT_TX_FAILED_MSK) {
 			event.evt_id = ESB_EVENT_TX_FAILED;
-			event_handler(&event);
+			call_event_handler(&event);
 		}
 		if (interrupts & INT_RX_DATA_RECEIVED_MSK) {
 			event.evt_id = ESB_EVENT_RX_RECEIVED;
-			event_handler(&event);
+			call_event_handler(&event);
 		}
 	}
+
+	profile_end(ESB_PROFILE_EVT_IRQ, start);
 }
 
 static void ESB_SYS_TIMER_IRQHandler(void)
 {
+	if (!ESB_SYS_TIMER->EVENTS_COMPARE[2]) {
+		return;
+	}
+	ESB_SYS_TIMER->EVENTS_COMPARE[2] = 0;
+
+	unsigned int key = irq_lock();
+
+	if (esb_state == ESB_STATE_PTX_LBT_BACKOFF) {
+		/* Assess the channel again, unless the TX FIFO was flushed
+		 * in the meantime.
+		 */
+		sys_timer_alarm_stop();
+		if (tx_fifo.count == 0) {
+			lbt_backoffs = 0;
+			esb_state = ESB_STATE_IDLE;
+		} else {
+			start_tx_transaction();
+		}
+	} else if (esb_state == ESB_STATE_PRX) {
+		/* Rate hunt: move to the next rate if no address was
+		 * received in the last dwell. Nothing else uses the ADDRESS
+		 * event on the PRX, so it is cleared here to start the next
+		 * dwell.
+		 */
+		ESB_SYS_TIMER->TASKS_CLEAR = 1;
+		if (NRF_RADIO->EVENTS_ADDRESS == 0) {
+			NRF_RADIO->SHORTS = 0;
+			on_radio_disabled = on_radio_disabled_rx_rate;
+			NRF_RADIO->TASKS_DISABLE = 1;
+		} else {
+			NRF_RADIO->EVENTS_ADDRESS = 0;
+		}
+	}
+
+	irq_unlock(key);
 }
 
 int esb_init(const struct esb_config *config)
 {
+	bool tx_power_changed;
+
 	if (config == NULL) {
 		return -EINVAL;
 	}
 
+	if ((ESB_PTX_ONLY && config->mode != ESB_MODE_PTX) ||
+	    (ESB_PRX_ONLY && config->mode != ESB_MODE_PRX) ||
+	    (ESB_DPL_ONLY && config->protocol != ESB_PROTOCOL_ESB_DPL)) {
+		return -ENOTSUP;
+	}
+
+	if (config->burst_length > ESB_BURST_LENGTH_MAX ||
+	    config->fec_group > ESB_FEC_GROUP_MAX ||
+	    (config->burst_length > 1 && config->fec_group > 1) ||
+	    (config->rate_adaptation &&
+	     rate_ladder_index(config->bitrate) < 0)) {
+		return -EINVAL;
+	}
+
+	/* A PTX that changed rate has to keep retransmitting until the hunting
+	 * PRX gets to it.
+	 */
+	if (config->rate_adaptation && config->mode == ESB_MODE_PTX &&
+	    (uint32_t)config->retransmit_delay *
+	    (config->retransmit_count + 1) <
+	    ARRAY_SIZE(rate_ladder) * ESB_RATE_HUNT_DWELL_US) {
+		return -EINVAL;
+	}
+
 	if (esb_initialized) {
 		esb_disable();
 	}
 
 	event_handler = config->event_handler;
 
+	/* Keep the rates learned so far across re-initializations that start
+	 * from the same bitrate.
+	 */
+	tx_power_changed = (esb_cfg.tx_output_power != config->tx_output_power);
+
+	if (!esb_cfg.rate_adaptation || esb_cfg.bitrate != config->bitrate) {
+		rate_hunt_idx = MAX(rate_ladder_index(config->bitrate), 0);
+		for (size_t i = 0; i < ARRAY_SIZE(rate); i++) {
+			rate[i] = (struct rate_state){ .idx = rate_hunt_idx };
+		}
+	}
+
 	memcpy(&esb_cfg, config, sizeof(esb_cfg));
 
 	interrupt_flags = 0;
 
 	memset(rx_pipe_info, 0, sizeof(rx_pipe_info));
 	memset(pids, 0, sizeof(pids));
+	esb_reset_stats();
+
+	/* Keep the group numbers running across re-initializations. A group
+	 * that was partly sent was flushed, so the next frames start a new one.
+	 */
+	for (size_t i = 0; i < CONFIG_ESB_PIPE_COUNT; i++) {
+		fec_tx_restart(i);
+		fec_state_reset(&fec[i]);
+	}
+
+	lbt_backoffs = 0;
+	lbt_rand = NRF_FICR->DEVICEADDR[0] | 1;
 
 	update_radio_parameters();
+	if (tx_power_changed) {
+		tx_power_reset();
+	}
 
 	/* Configure radio address registers according to ESB default values */
 	NRF_RADIO->BASE0 = 0xE7E7E7E7;
@@ -1027,6 +2718,28 @@ int esb_init(const struct esb_config *config)
 	initialize_fifos();
 	sys_timer_init();
 	ppi_init();
+	radio_isr_timing_init();
+	esb_reset_profile();
+
+	timestamps = config->timestamps;
+	timestamp_init();
+
+#if ESB_HW_RETRANSMIT_SUPPORTED
+	hw_retransmit = config->hw_retransmit &&
+			(config->mode == ESB_MODE_PTX) &&
+			(config->protocol == ESB_PROTOCOL_ESB_DPL) &&
+			(config->retransmit_count > 0) &&
+			(config->burst_length <= 1);
+	if (hw_retransmit) {
+		hw_retransmit_init();
+		IRQ_DIRECT_CONNECT(ESB_HW_RETRANSMIT_TIMER_IRQn,
+				   config->radio_irq_priority,
+				   ESB_HW_RETRANSMIT_TIMER_IRQHandler, 0);
+		irq_enable(ESB_HW_RETRANSMIT_TIMER_IRQn);
+	}
+#else
+	hw_retransmit = false;
+#endif
 
 	IRQ_DIRECT_CONNECT(ESB_EVT_IRQ, config->event_irq_priority,
 			   ESB_EVT_IRQHandler, 0);
@@ -1038,29 +2751,70 @@ int esb_init(const struct esb_config *config)
 	irq_enable(ESB_SYS_TIMER_IRQn);
 
 	esb_state = ESB_STATE_IDLE;
-	esb_initialized = true;
+	esb_initialized = true;
+
+#ifdef CONFIG_SOC_NRF52832
+	if ((NRF_FICR->INFO.VARIANT & 0x0000FF00) == 0x00004500) {
+		/* Check if the device is an nRF52832 Rev. 2. */
+		/* Workaround for nRF52832 rev 2 errata 182 */
+		*(volatile uint32_t *)0x4000173C |= (1 << 10);
+	}
+#endif
+
+	return 0;
+}
+
+int esb_suspend(void)
+{
+	if (!esb_initialized) {
+		return -EACCES;
+	}
+
+	unsigned int key = irq_lock();
+
+	/*  Clear PPI */
+	nrfx_gppi_channels_disable(ppi_all_channels_mask);
+	hw_retransmit_stop();
+	sys_timer_alarm_stop();
+	lbt_ppi_disable();
+	lbt_clear = false;
+
+	/* Abort the transaction on air. Its packet stays at the front of the
+	 * TX FIFO and is sent again by the next esb_start_tx().
+	 */
+	NRF_RADIO->SHORTS = 0;
+	NRF_RADIO->INTENCLR = 0xFFFFFFFF;
+	NRF_RADIO->TASKS_DISABLE = 1;
+	NVIC_ClearPendingIRQ(RADIO_IRQn);
+	on_radio_disabled = NULL;
+	tx_staged = TX_STAGED_NONE;
+	burst_count = 0;
+
+	esb_state = ESB_STATE_IDLE;
 
-#ifdef CONFIG_SOC_NRF52832
-	if ((NRF_FICR->INFO.VARIANT & 0x0000FF00) == 0x00004500) {
-		/* Check if the device is an nRF52832 Rev. 2. */
-		/* Workaround for nRF52832 rev 2 errata 182 */
-		*(volatile uint32_t *)0x4000173C |= (1 << 10);
-	}
-#endif
+	irq_unlock(key);
 
 	return 0;
 }
 
-int esb_suspend(void)
+int esb_resume(void)
 {
+	if (!esb_initialized) {
+		return -EACCES;
+	}
 	if (esb_state != ESB_STATE_IDLE) {
 		return -EBUSY;
 	}
 
-	/*  Clear PPI */
-	nrfx_gppi_channels_disable(ppi_all_channels_mask);
-
-	esb_state = ESB_STATE_IDLE;
+	if (!update_radio_parameters()) {
+		return -EINVAL;
+	}
+	update_radio_addresses(ADDR_UPDATE_MASK_BASE0 | ADDR_UPDATE_MASK_BASE1 |
+			       ADDR_UPDATE_MASK_PREFIX);
+	sys_timer_init();
+#ifdef DPPI_PRESENT
+	dppi_radio_connect();
+#endif
 
 	return 0;
 }
@@ -1069,6 +2823,11 @@ void esb_disable(void)
 {
 	/*  Clear PPI */
 	nrfx_gppi_channels_disable(ppi_all_channels_mask);
+	hw_retransmit_stop();
+	timestamp_stop();
+	sys_timer_alarm_stop();
+	lbt_ppi_disable();
+	lbt_clear = false;
 
 	esb_state = ESB_STATE_IDLE;
 	esb_initialized = false;
@@ -1100,8 +2859,55 @@ static struct payload_wrap *find_free_payload_cont(void)
 	return 0;
 }
 
+static void tx_fifo_push(const struct esb_payload *payload)
+{
+	memcpy(tx_fifo.payload[tx_fifo.back], payload,
+		sizeof(struct esb_payload));
+
+	pids[payload->pipe] = (pids[payload->pipe] + 1) % (PID_MAX + 1);
+	tx_fifo.payload[tx_fifo.back]->pid = pids[payload->pipe];
+
+	if (++tx_fifo.back >= CONFIG_ESB_TX_FIFO_SIZE) {
+		tx_fifo.back = 0;
+	}
+
+	tx_fifo.count++;
+}
+
+/* Queue a payload with its FEC header, followed by the parity frame when it
+ * completes a group.
+ */
+static void tx_fifo_push_fec(const struct esb_payload *payload)
+{
+	struct fec_state *f = &fec[payload->pipe];
+
+	fec_frame = *payload;
+	fec_frame.length = payload->length + 1;
+	fec_frame.data[0] = FEC_HDR(f->group, f->index);
+	memcpy(&fec_frame.data[1], payload->data, payload->length);
+	tx_fifo_push(&fec_frame);
+
+	fec_xor(f, payload->length, payload->data);
+	f->max_len = MAX(f->max_len, payload->length);
+
+	if (++f->index < esb_cfg.fec_group) {
+		return;
+	}
+
+	fec_frame.length = f->max_len + 2;
+	fec_frame.data[0] = FEC_HDR(f->group, FEC_INDEX_PARITY);
+	memcpy(&fec_frame.data[1], f->parity, f->max_len + 1);
+	tx_fifo_push(&fec_frame);
+
+	f->group = (f->group + 1) & 0x0F;
+	f->index = 0;
+	fec_state_reset(f);
+}
+
 int esb_write_payload(const struct esb_payload *payload)
 {
+	uint32_t slots = 1;
+
 	if (!esb_initialized) {
 		return -EACCES;
 	}
@@ -1110,31 +2916,33 @@ int esb_write_payload(const struct esb_payload *payload)
 	}
 	if (payload->length == 0 ||
 	    payload->length > CONFIG_ESB_MAX_PAYLOAD_LENGTH ||
-	    (esb_cfg.protocol == ESB_PROTOCOL_ESB &&
+	    (burst_enabled() &&
+	     payload->length > CONFIG_ESB_MAX_PAYLOAD_LENGTH - 1) ||
+	    (fec_enabled() && payload->length > FEC_DATA_MAX) ||
+	    (ESB_PROTOCOL() == ESB_PROTOCOL_ESB &&
 	     payload->length > esb_cfg.payload_length)) {
 		return -EMSGSIZE;
 	}
-	if (tx_fifo.count >= CONFIG_ESB_TX_FIFO_SIZE) {
-		return -ENOMEM;
-	}
 	if (payload->pipe >= CONFIG_ESB_PIPE_COUNT) {
 		return -EINVAL;
 	}
+	if (ESB_MODE() == ESB_MODE_PTX && fec_enabled() &&
+	    fec[payload->pipe].index == esb_cfg.fec_group - 1) {
+		/* Room for the parity frame too. */
+		slots = 2;
+	}
+	if (tx_fifo.count + slots > CONFIG_ESB_TX_FIFO_SIZE) {
+		return -ENOMEM;
+	}
 
 	uint32_t key = irq_lock();
 
-	if (esb_cfg.mode == ESB_MODE_PTX) {
-		memcpy(tx_fifo.payload[tx_fifo.back], payload,
-			sizeof(struct esb_payload));
-
-		pids[payload->pipe] = (pids[payload->pipe] + 1) % (PID_MAX + 1);
-		tx_fifo.payload[tx_fifo.back]->pid = pids[payload->pipe];
-
-		if (++tx_fifo.back >= CONFIG_ESB_TX_FIFO_SIZE) {
-			tx_fifo.back = 0;
+	if (ESB_MODE() == ESB_MODE_PTX) {
+		if (fec_enabled()) {
+			tx_fifo_push_fec(payload);
+		} else {
+			tx_fifo_push(payload);
 		}
-
-		tx_fifo.count++;
 	} else {
 		struct payload_wrap *new_ack_payload = find_free_payload_cont();
 
@@ -1157,12 +2965,21 @@ int esb_write_payload(const struct esb_payload *payload)
 				pl->p_next = (struct payload_wrap *)new_ack_payload;
 			}
 			tx_fifo.count++;
+
+			if (ESB_PROTOCOL() == ESB_PROTOCOL_ESB_DPL) {
+				ack_frames_stage(payload->pipe);
+			}
 		}
 	}
 
+	if (ESB_MODE() == ESB_MODE_PTX && esb_state != ESB_STATE_IDLE) {
+		/* Streaming: stage the packet while the current one is on air. */
+		tx_stage_next();
+	}
+
 	irq_unlock(key);
 
-	if (esb_cfg.mode == ESB_MODE_PTX &&
+	if (ESB_MODE() == ESB_MODE_PTX &&
 	    esb_cfg.tx_mode == ESB_TXMODE_AUTO &&
 	    esb_state == ESB_STATE_IDLE) {
 		start_tx_transaction();
@@ -1191,6 +3008,7 @@ int esb_read_rx_payload(struct esb_payload *payload)
 	payload->rssi = rx_fifo.payload[rx_fifo.front]->rssi;
 	payload->pid = rx_fifo.payload[rx_fifo.front]->pid;
 	payload->noack = rx_fifo.payload[rx_fifo.front]->noack;
+	payload->timestamp = rx_fifo.payload[rx_fifo.front]->timestamp;
 	memcpy(payload->data, rx_fifo.payload[rx_fifo.front]->data,
 	       payload->length);
 
@@ -1207,6 +3025,10 @@ int esb_read_rx_payload(struct esb_payload *payload)
 
 int esb_start_tx(void)
 {
+	if (ESB_PRX_ONLY) {
+		return -ENOTSUP;
+	}
+
 	if (esb_state != ESB_STATE_IDLE) {
 		return -EBUSY;
 	}
@@ -1222,6 +3044,10 @@ int esb_start_tx(void)
 
 int esb_start_rx(void)
 {
+	if (ESB_PTX_ONLY) {
+		return -ENOTSUP;
+	}
+
 	if (esb_state != ESB_STATE_IDLE) {
 		return -EBUSY;
 	}
@@ -1234,11 +3060,17 @@ int esb_start_rx(void)
 			    RADIO_SHORTS_DISABLED_TXEN_Msk;
 	NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
 	esb_state = ESB_STATE_PRX;
+	TRACE(ESB_TRACE_STATE, 0, 0, 0, NULL, 0);
 
 	NRF_RADIO->RXADDRESSES = esb_addr.rx_pipes_enabled;
 	NRF_RADIO->FREQUENCY = esb_addr.rf_channel;
 	NRF_RADIO->PACKETPTR = (uint32_t)rx_payload_buffer;
 
+	if (esb_cfg.rate_adaptation) {
+		/* Resume the hunt at the last rate, also after esb_init. */
+		(void)radio_bitrate_set(rate_ladder[rate_hunt_idx]);
+	}
+
 	NVIC_ClearPendingIRQ(RADIO_IRQn);
 	irq_enable(RADIO_IRQn);
 
@@ -1248,6 +3080,10 @@ int esb_start_rx(void)
 
 	NRF_RADIO->TASKS_RXEN = 1;
 
+	if (esb_cfg.rate_adaptation) {
+		sys_timer_alarm_start(ESB_RATE_HUNT_DWELL_US);
+	}
+
 	return 0;
 }
 
@@ -1257,18 +3093,38 @@ int esb_stop_rx(void)
 		return -EINVAL;
 	}
 
+	/* The radio interrupt completes the stop when the radio is disabled,
+	 * esb_is_idle() reports when it has happened.
+	 */
+	unsigned int key = irq_lock();
+
 	NRF_RADIO->SHORTS = 0;
 	NRF_RADIO->INTENCLR = 0xFFFFFFFF;
-	on_radio_disabled = NULL;
+	on_radio_disabled = on_radio_disabled_rx_stopped;
+	esb_state = ESB_STATE_PRX_STOPPING;
+	TRACE(ESB_TRACE_STATE, 0, 0, 0, NULL, 0);
 	NRF_RADIO->EVENTS_DISABLED = 0;
+	NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
 	NRF_RADIO->TASKS_DISABLE = 1;
-	while (NRF_RADIO->EVENTS_DISABLED == 0) {
-		/* wait for register to settle */
+
+	irq_unlock(key);
+
+	return 0;
+}
+
+int esb_get_radio_isr_wcet(uint32_t *cycles)
+{
+#if ESB_ISR_PROFILING
+	if (!cycles) {
+		return -EINVAL;
 	}
 
-	esb_state = ESB_STATE_IDLE;
+	*cycles = radio_isr_wcet;
 
 	return 0;
+#else
+	return -ENOTSUP;
+#endif
 }
 
 int esb_flush_tx(void)
@@ -1282,6 +3138,12 @@ int esb_flush_tx(void)
 	tx_fifo.count = 0;
 	tx_fifo.back = 0;
 	tx_fifo.front = 0;
+	tx_staged = TX_STAGED_NONE;
+	memset(ack_frame_wrap, 0, sizeof(ack_frame_wrap));
+
+	for (size_t i = 0; i < CONFIG_ESB_PIPE_COUNT; i++) {
+		fec_tx_restart(i);
+	}
 
 	irq_unlock(key);
 
@@ -1303,6 +3165,59 @@ int esb_pop_tx(void)
 		tx_fifo.back = 0;
 	}
 	tx_fifo.count--;
+	tx_staged = TX_STAGED_NONE;
+	memset(ack_frame_wrap, 0, sizeof(ack_frame_wrap));
+
+	/* The popped frame may belong to any pipe's open group. */
+	for (size_t i = 0; i < CONFIG_ESB_PIPE_COUNT; i++) {
+		fec_tx_restart(i);
+	}
+
+	irq_unlock(key);
+
+	return 0;
+}
+
+int esb_flush_tx_pipe(uint8_t pipe)
+{
+	if (!esb_initialized) {
+		return -EACCES;
+	}
+	if (pipe >= CONFIG_ESB_PIPE_COUNT || ESB_MODE() != ESB_MODE_PTX) {
+		return -EINVAL;
+	}
+
+	uint32_t key = irq_lock();
+
+	if (esb_state != ESB_STATE_IDLE) {
+		irq_unlock(key);
+		return -EBUSY;
+	}
+
+	uint32_t count = tx_fifo.count;
+	uint32_t index = tx_fifo.front;
+
+	/* Move the packets that are kept down over the removed ones. */
+	tx_fifo.back = tx_fifo.front;
+	tx_fifo.count = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		struct esb_payload *payload = tx_fifo.payload[index];
+
+		if (payload->pipe != pipe) {
+			tx_fifo.payload[index] = tx_fifo.payload[tx_fifo.back];
+			tx_fifo.payload[tx_fifo.back] = payload;
+			if (++tx_fifo.back >= CONFIG_ESB_TX_FIFO_SIZE) {
+				tx_fifo.back = 0;
+			}
+			tx_fifo.count++;
+		}
+		if (++index >= CONFIG_ESB_TX_FIFO_SIZE) {
+			index = 0;
+		}
+	}
+	tx_staged = TX_STAGED_NONE;
+	memset(ack_frame_wrap, 0, sizeof(ack_frame_wrap));
+	fec_tx_restart(pipe);
 
 	irq_unlock(key);
 
@@ -1442,6 +3357,133 @@ int esb_set_rf_channel(uint32_t channel)
 	return 0;
 }
 
+/* Samples per channel visit of esb_scan. */
+#define ESB_SCAN_SAMPLES 8
+
+/* Upper bound of one channel visit: the RX ramp-up, the samples and the
+ * disable.
+ */
+#define ESB_SCAN_VISIT_US(ramp_up_us) ((ramp_up_us) + 20)
+
+/* Samples of the range being scanned, kept across calls so that a sweep can
+ * be spread over several budgets.
+ */
+static struct {
+	bool started;
+	uint8_t first;
+	uint8_t last;
+	uint8_t next;
+	uint32_t sum[101];
+	uint8_t peak[101];
+	uint16_t samples[101];
+} scan;
+
+/* Take ESB_SCAN_SAMPLES RSSI samples on a channel. */
+static void scan_channel(uint8_t channel)
+{
+	uint8_t i = channel - scan.first;
+
+	/* Halve old samples before the count overflows, they weigh less. */
+	if (scan.samples[i] > UINT16_MAX - ESB_SCAN_SAMPLES) {
+		scan.sum[i] /= 2;
+		scan.samples[i] /= 2;
+	}
+
+	radio_rx_ready_wait(channel);
+
+	for (int j = 0; j < ESB_SCAN_SAMPLES; j++) {
+		uint8_t sample = radio_rssi_sample();
+
+		scan.sum[i] += sample;
+		scan.peak[i] = MIN(scan.peak[i], sample);
+		scan.samples[i]++;
+	}
+
+	radio_disable_wait();
+}
+
+void esb_scan_reset(void)
+{
+	memset(&scan, 0, sizeof(scan));
+}
+
+int esb_scan(uint8_t first, uint8_t last, uint32_t budget_us,
+	     struct esb_scan_result *results, size_t count)
+{
+	uint32_t visit_us = ESB_SCAN_VISIT_US(ramp_up_time_us);
+	uint32_t shorts;
+	uint32_t frequency;
+	uint32_t start;
+	size_t n = 0;
+
+	if (!esb_initialized) {
+		return -EACCES;
+	}
+	if (esb_state != ESB_STATE_IDLE) {
+		return -EBUSY;
+	}
+	if (first > last || last > 100 || results == NULL ||
+	    count < last - first + 1) {
+		return -EINVAL;
+	}
+
+	if (!scan.started || first != scan.first || last != scan.last) {
+		esb_scan_reset();
+		scan.started = true;
+		scan.first = first;
+		scan.last = last;
+		scan.next = first;
+		memset(scan.peak, UINT8_MAX, sizeof(scan.peak));
+	}
+
+	irq_disable(RADIO_IRQn);
+	shorts = NRF_RADIO->SHORTS;
+	frequency = NRF_RADIO->FREQUENCY;
+	NRF_RADIO->SHORTS = 0;
+
+	/* Visit channels while the next visit fits in the budget, and continue
+	 * from there in the next call.
+	 */
+	start = k_cycle_get_32();
+	while (k_cyc_to_us_ceil32(k_cycle_get_32() - start) + visit_us <=
+	       budget_us) {
+		scan_channel(scan.next);
+		scan.next = (scan.next == last) ? first : scan.next + 1;
+	}
+
+	NRF_RADIO->SHORTS = shorts;
+	NRF_RADIO->FREQUENCY = frequency;
+	NRF_RADIO->EVENTS_DISABLED = 0;
+	NVIC_ClearPendingIRQ(RADIO_IRQn);
+	irq_enable(RADIO_IRQn);
+
+	/* Insertion sort of the channels sampled so far, quietest first. */
+	for (uint8_t i = 0; i <= last - first; i++) {
+		struct esb_scan_result result;
+		size_t j = n;
+
+		if (scan.samples[i] == 0) {
+			continue;
+		}
+		result.channel = first + i;
+		result.rssi_avg = scan.sum[i] / scan.samples[i];
+		result.rssi_peak = scan.peak[i];
+		result.samples = scan.samples[i];
+
+		while (j > 0 &&
+		       (results[j - 1].rssi_avg < result.rssi_avg ||
+			(results[j - 1].rssi_avg == result.rssi_avg &&
+			 results[j - 1].rssi_peak < result.rssi_peak))) {
+			results[j] = results[j - 1];
+			j--;
+		}
+		results[j] = result;
+		n++;
+	}
+
+	return n;
+}
+
 int esb_get_rf_channel(uint32_t *channel)
 {
 	if (channel == NULL) {
@@ -1462,6 +3504,7 @@ int esb_set_tx_power(enum esb_tx_power tx_output_power)
 	if (esb_cfg.tx_output_power != tx_output_power) {
 		esb_cfg.tx_output_power = tx_output_power;
 		update_radio_tx_power();
+		tx_power_reset();
 	}
 
 	return 0;
@@ -1472,7 +3515,7 @@ int esb_set_retransmit_delay(uint16_t delay)
 	if (esb_state != ESB_STATE_IDLE) {
 		return -EBUSY;
 	}
-	if (delay < RETRANSMIT_DELAY_MIN) {
+	if (delay < RETRANSMIT_DELAY_MIN(ramp_up_time_us)) {
 		return -EINVAL;
 	}
 
@@ -1503,6 +3546,23 @@ int esb_set_bitrate(enum esb_bitrate bitrate)
 	return update_radio_bitrate() ? 0 : -EINVAL;
 }
 
+int esb_get_pipe_bitrate(uint8_t pipe, enum esb_bitrate *bitrate)
+{
+	if (pipe >= CONFIG_ESB_PIPE_COUNT || bitrate == NULL) {
+		return -EINVAL;
+	}
+
+	if (!esb_cfg.rate_adaptation) {
+		*bitrate = esb_cfg.bitrate;
+	} else if (ESB_MODE() == ESB_MODE_PRX) {
+		*bitrate = rate_ladder[rate_hunt_idx];
+	} else {
+		*bitrate = rate_ladder[rate[pipe].idx];
+	}
+
+	return 0;
+}
+
 int esb_reuse_pid(uint8_t pipe)
 {
 	if (esb_state != ESB_STATE_IDLE) {
@@ -1534,3 +3594,154 @@ int esb_set_pid(uint8_t pipe, uint8_t pid)
 	pids[pipe] = pid;
 	return 0;
 }
+
+int esb_get_stats(uint8_t pipe, struct esb_stats *stats_out)
+{
+	if (CONFIG_ESB_PIPE_COUNT <= pipe || !stats_out) {
+		return -EINVAL;
+	}
+
+	uint32_t key = irq_lock();
+
+	*stats_out = stats[pipe];
+
+	irq_unlock(key);
+
+	return 0;
+}
+
+void esb_reset_stats(void)
+{
+	uint32_t key = irq_lock();
+
+	memset(stats, 0, sizeof(stats));
+	memset(rssi_avg_q4, 0, sizeof(rssi_avg_q4));
+
+	irq_unlock(key);
+}
+
+int esb_get_timestamp(uint32_t *now)
+{
+	if (!now) {
+		return -EINVAL;
+	}
+
+#if ESB_TIMESTAMP_SUPPORTED
+	if (!esb_initialized || !timestamps) {
+		return -EACCES;
+	}
+
+	ESB_TIMESTAMP_TIMER->TASKS_CAPTURE[1] = 1;
+	*now = ESB_TIMESTAMP_TIMER->CC[1];
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+int esb_get_profile(enum esb_profile_id id, struct esb_profile *profile_out)
+{
+#if ESB_ISR_PROFILING
+	if (id >= ESB_PROFILE_COUNT || !profile_out) {
+		return -EINVAL;
+	}
+
+	uint32_t key = irq_lock();
+	struct profile_data *p = &profile[id];
+
+	profile_out->count = p->count;
+	profile_out->min = p->min;
+	profile_out->max = p->max;
+	profile_out->mean = p->count ? (uint32_t)(p->total / p->count) : 0;
+	memcpy(profile_out->hist, p->hist, sizeof(profile_out->hist));
+
+	irq_unlock(key);
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+void esb_reset_profile(void)
+{
+#if ESB_ISR_PROFILING
+	uint32_t key = irq_lock();
+
+	memset(profile, 0, sizeof(profile));
+
+	irq_unlock(key);
+#endif
+}
+
+int esb_trace_read(struct esb_trace_record *records, size_t count,
+		   uint32_t *lost)
+{
+#if ESB_TRACE
+	uint32_t head = (uint32_t)atomic_get(&trace_head);
+	uint32_t skipped = 0;
+	size_t read = 0;
+
+	if (!records) {
+		return -EINVAL;
+	}
+
+	if (head - trace_tail > ESB_TRACE_BUFFER_SIZE) {
+		skipped = head - trace_tail - ESB_TRACE_BUFFER_SIZE;
+		trace_tail = head - ESB_TRACE_BUFFER_SIZE;
+	}
+
+	while (read < count && trace_tail != head) {
+		const struct esb_trace_record *rec =
+			&trace_buffer[trace_tail & (ESB_TRACE_BUFFER_SIZE - 1)];
+
+		/* Stop at a record that is still being written. */
+		if (rec->seq != (uint16_t)trace_tail) {
+			break;
+		}
+
+		records[read] = *rec;
+		__DMB();
+
+		/* Drop it if a writer wrapped around while it was copied. */
+		if ((uint32_t)atomic_get(&trace_head) - trace_tail >
+		    ESB_TRACE_BUFFER_SIZE) {
+			skipped++;
+		} else {
+			read++;
+		}
+		trace_tail++;
+	}
+
+	if (lost) {
+		*lost = skipped;
+	}
+
+	return read;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+int esb_trace_drain_rtt(unsigned int channel)
+{
+#if ESB_TRACE && defined(CONFIG_USE_SEGGER_RTT)
+	struct esb_trace_record records[8];
+	int total = 0;
+	int read;
+
+	do {
+		read = esb_trace_read(records, ARRAY_SIZE(records), NULL);
+		if (read > 0) {
+			SEGGER_RTT_Write(channel, records,
+					 read * sizeof(records[0]));
+			total += read;
+		}
+	} while (read == ARRAY_SIZE(records));
+
+	return total;
+#else
+	return -ENOTSUP;
+#endif
+}